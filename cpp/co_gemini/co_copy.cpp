@@ -1,5 +1,12 @@
 #include "util/argparser.hpp"
 #include "util/logger.hpp"
+#include "util/histogram.hpp"
+#include "util/zipf.hpp"
+#include "util/crc32c.hpp"
+#include "util/zero.hpp"
+#include "util/io_context.hpp"
+#include "util/when.hpp"
+#include "util/nvme_status.hpp"
 
 #include <iostream>
 #include <vector>
@@ -8,14 +15,35 @@
 #include <coroutine>
 #include <stdexcept>
 #include <memory>
-#include <functional>
 #include <charconv>
 #include <cstring>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <optional>
+#include <numeric>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <pthread.h>
+#include <endian.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <linux/falloc.h>
 #include <liburing.h>
 #include <libnvme.h>
 
 Logger logger(LogLevel::INFO);
 
+// Set by SIGINT; every ring then cancels its I/O in flight and drains.
+static std::atomic<bool> cancel_requested{false};
+
+// Failed passthrough commands of the run, by NVMe status.
+static NvmeStatusTable nvme_errors;
+
 static __u64 time_get_ns(void)
 {
     struct timespec ts;
@@ -30,6 +58,10 @@ static __u64 time_get_ns(void)
 #define NVME_URING_CMD_ADMIN _IOWR('N', 0x82, struct nvme_uring_cmd)
 #define NVME_URING_CMD_ADMIN_VEC _IOWR('N', 0x83, struct nvme_uring_cmd)
 
+#ifndef IORING_TIMEOUT_MULTISHOT
+#define IORING_TIMEOUT_MULTISHOT (1U << 6)
+#endif
+
 #if LIBURING_VERSION_MAJOR < 2
 static inline void io_uring_prep_nvme_cmd(struct io_uring_sqe *sqe, int fd)
 {
@@ -39,63 +71,227 @@ static inline void io_uring_prep_nvme_cmd(struct io_uring_sqe *sqe, int fd)
 }
 #endif
 
-struct task
+struct request : IoCompletion
 {
-    struct promise_type
-    {
-        task get_return_object() { return {}; }
-        std::suspend_never initial_suspend() { return {}; }
-        std::suspend_never final_suspend() noexcept { return {}; }
-        void return_void() {}
-        void unhandled_exception() { std::terminate(); }
-    };
+    __u64 slba = 0;
+    char rw_dir = 0;
+    struct iovec iov;
+    char *buf;
+    int buf_index = -1;
+    __u32 len;
+    __u8 sqe_flags = 0;
+    bool passthru = false;
+    __u8 lr = 0; /* NVMe Limited Retry bit of a passthrough command */
+    __u64 submit_ns = 0;
+    bool deadline = false;      /* followed by a linked timeout */
+    bool chained = false;       /* behind SQEs whose failure cancels it */
+    std::vector<request> parts; /* commands of an I/O split at the transfer limit */
 };
 
-struct request
+// Bytes a completed request transferred; throws if it failed.
+int io_result(const request &req)
 {
-    std::coroutine_handle<> handle;
-    int cqe_res;
-    __u64 slba;
-    char rw_dir;
-    struct iovec iov;
-    std::unique_ptr<char[]> buf;
-};
+    if (req.res < 0)
+        throw std::runtime_error(strerror(-req.res));
+    logger.debug("complete: {} {}", req.rw_dir, req.slba);
+    // Passthrough completes with the NVMe status, and transfers the whole length on success.
+    if (req.passthru)
+    {
+        if (req.res > 0)
+            throw std::runtime_error(std::format("NVMe {:#x} {}, result {:#x}", req.res, NvmeStatus(req.res).str(), req.big_cqe[0]));
+        return req.len;
+    }
+    return req.res;
+}
 
-struct io_awaitable
+// Counting semaphore for the coroutines of one ring. Slots are handed straight
+// to the oldest waiter, which resumes inside release().
+class ring_semaphore
 {
-    request *req;
+    int count;
+    std::deque<std::coroutine_handle<>> waiters;
+
+public:
+    explicit ring_semaphore(int count) : count(count) {}
+
+    // Holds one slot until released or destroyed, so an exception cannot leak it.
+    class slot
+    {
+        ring_semaphore *sem;
 
-    io_awaitable(request *r) : req(r) {}
-    bool await_ready() const { return false; }
-    void await_suspend(std::coroutine_handle<> h)
+    public:
+        explicit slot(ring_semaphore *s) : sem(s) {}
+        slot(slot &&other) : sem(std::exchange(other.sem, nullptr)) {}
+        ~slot() { release(); }
+        void release()
+        {
+            if (sem)
+                std::exchange(sem, nullptr)->release();
+        }
+    };
+
+    struct acquire_awaitable
+    {
+        ring_semaphore &sem;
+        bool await_ready()
+        {
+            if (sem.count == 0)
+                return false;
+            sem.count--;
+            return true;
+        }
+        void await_suspend(std::coroutine_handle<> h) { sem.waiters.push_back(h); }
+        slot await_resume() { return slot(&sem); }
+    };
+
+    acquire_awaitable acquire() { return {*this}; }
+
+    void release()
     {
-        req->handle = h;
-        logger.debug("await_suspend: {} {}", req->rw_dir, req->slba);
+        if (waiters.empty())
+        {
+            count++;
+            return;
+        }
+        auto h = waiters.front();
+        waiters.pop_front();
+        h.resume();
     }
-    int await_resume() const
+};
+
+class BufferPool
+{
+    char *base = nullptr;
+    size_t buf_size;
+    std::vector<struct iovec> iovs;
+    std::vector<int> free_list;
+    bool registered = false;
+
+public:
+    BufferPool(struct io_uring *ring, int count, size_t size, size_t align = 4096)
+        : buf_size((size + align - 1) / align * align)
     {
-        if (req->cqe_res < 0)
+        if (posix_memalign(reinterpret_cast<void **>(&base), align, buf_size * count))
+            throw std::runtime_error("Failed to allocate I/O buffers");
+        memset(base, 0, buf_size * count);
+        for (int i = 0; i < count; i++)
         {
-            throw std::runtime_error(strerror(-req->cqe_res));
+            iovs.push_back({.iov_base = base + i * buf_size, .iov_len = buf_size});
+            free_list.push_back(count - 1 - i);
         }
-        logger.debug("await_resume: {} {}", req->rw_dir, req->slba);
-        return req->cqe_res;
+
+        int ret = io_uring_register_buffers(ring, iovs.data(), iovs.size());
+        if (ret < 0)
+            logger.warning("io_uring_register_buffers: {}, using unregistered buffers", strerror(-ret));
+        else
+            registered = true;
+        logger.debug("BufferPool: {} x {} bytes, registered {}", count, buf_size, registered);
+    }
+
+    // The ring keeps registered buffers pinned until it exits, after the pool.
+    ~BufferPool() { free(base); }
+
+    void acquire(request *req)
+    {
+        int idx = free_list.back();
+        free_list.pop_back();
+        req->buf = static_cast<char *>(iovs[idx].iov_base);
+        req->buf_index = registered ? idx : -1;
+    }
+
+    void release(request *req)
+    {
+        free_list.push_back((req->buf - base) / buf_size);
+        req->buf = nullptr;
     }
 };
 
+// Makes room for n SQEs that must reach the kernel in one submission, such as
+// a linked chain, flushing the SQ first when it has less. The SQ fills up when
+// an I/O takes more SQEs than the ring was sized for.
+void reserve_sqes(io_uring *ring, unsigned n)
+{
+    if (io_uring_sq_space_left(ring) >= n)
+        return;
+    io_uring_submit(ring);
+    if (io_uring_sq_space_left(ring) < n)
+        throw std::runtime_error("Submission queue full");
+}
+
 class IOHandler
 {
 protected:
     bool valid = false;
+    int fixed_slot = -1;
+    std::atomic<bool> zeroes_ok{true};
+    struct __kernel_timespec io_timeout = {};
+
+    // SQE of the next I/O. With a deadline set, its linked timeout is reserved
+    // along with it, so a flush cannot submit the I/O without its link.
+    io_uring_sqe *get_sqe(io_uring *ring)
+    {
+        reserve_sqes(ring, io_timeout.tv_sec || io_timeout.tv_nsec ? 2 : 1);
+        return io_uring_get_sqe(ring);
+    }
+
+    // Common tail of every prep_*, on an SQE from get_sqe(). With an I/O
+    // deadline set, the SQE is followed by an IORING_OP_LINK_TIMEOUT that
+    // cancels it once the deadline passes; an SQE that already heads a chain is
+    // left alone.
+    void prep_sqe(io_uring *ring, io_uring_sqe *sqe, request *req)
+    {
+        req->submit_ns = time_get_ns();
+        req->chained = false;
+        sqe->flags = req->sqe_flags;
+        if (fixed_slot >= 0)
+        {
+            sqe->fd = fixed_slot;
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
+        req->deadline = (io_timeout.tv_sec || io_timeout.tv_nsec) && !(req->sqe_flags & IOSQE_IO_LINK);
+        if (req->deadline)
+        {
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe *timeout = io_uring_get_sqe(ring);
+            io_uring_prep_link_timeout(timeout, &io_timeout, 0);
+            io_uring_sqe_set_data(timeout, nullptr);
+        }
+    }
 
 public:
     virtual ~IOHandler() = default;
     virtual void prep_read(io_uring *ring, __u64 offset, __u32 len, request *req) = 0;
     virtual void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) = 0;
+    // Queues the read of data just written, for --verify; it must come from the
+    // medium rather than a cache still holding what was written.
+    virtual void prep_read_back(io_uring *ring, __u64 offset, __u32 len, request *req) { prep_read(ring, offset, len, req); }
     virtual const std::string &get_name() const = 0;
     virtual bool is_block_device() const = 0;
     virtual size_t get_size() const = 0;
+    virtual int get_fd() const { return -1; }
+    virtual __u32 get_alignment() const { return 1; }
+    // Largest I/O issued as a single command, 0 if unlimited; larger ones are split.
+    virtual __u32 get_max_transfer() const { return 0; }
+    virtual bool is_fixed_length() const { return false; }
+    virtual bool supports_iopoll() const { return false; }
+    // Whether a failed I/O completes with -errno, which the kernel takes as
+    // failure and so cancels the rest of a linked chain.
+    virtual bool errors_break_links() const { return true; }
+    // Data ranges [start, end) below size; false if the handler cannot tell data from holes.
+    virtual bool data_extents(__u64 size, std::vector<std::pair<__u64, __u64>> &extents) const { return false; }
+    // Makes a range read back as zeros without writing it; 0 or -errno.
+    virtual int punch_hole(__u64 offset, __u64 len) { return -EOPNOTSUPP; }
+    virtual void set_size(__u64 size) {}
+    // Queues a write of zeros that moves no data (hole punch, Write Zeroes); false
+    // if the handler cannot, and the caller writes the zeroed buffer instead.
+    virtual bool prep_write_zeroes(io_uring *ring, __u64 offset, __u32 len, request *req) { return false; }
+    bool zeroes_enabled() const { return zeroes_ok.load(std::memory_order_relaxed); }
+    // Returns true for the caller that actually turned the offload off.
+    bool disable_zeroes() { return zeroes_ok.exchange(false, std::memory_order_relaxed); }
     bool is_valid() const { return valid; };
+    void set_fixed_slot(int slot) { fixed_slot = slot; }
+    void set_io_timeout(__u64 ns) { io_timeout = {.tv_sec = static_cast<long long>(ns / 1000000000), .tv_nsec = static_cast<long long>(ns % 1000000000)}; }
 };
 
 class DummyIOHandler : public IOHandler
@@ -142,26 +338,261 @@ public:
 
     void prep_read(io_uring *ring, __u64 offset, __u32 len, request *req) override
     {
-        io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        req->iov = {.iov_base = req->buf.get(), .iov_len = len};
+        io_uring_sqe *sqe = get_sqe(ring);
         req->rw_dir = 'R';
         req->slba = offset;
-        io_uring_prep_readv(sqe, fd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
+        if (req->buf_index >= 0)
+            io_uring_prep_read_fixed(sqe, fd, req->buf, len, offset, req->buf_index);
+        else
+        {
+            req->iov = {.iov_base = req->buf, .iov_len = len};
+            io_uring_prep_readv(sqe, fd, &req->iov, 1, offset);
+        }
+        prep_sqe(ring, sqe, req);
     }
 
     void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
     {
-        io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        req->iov.iov_len = len;
+        io_uring_sqe *sqe = get_sqe(ring);
         req->rw_dir = 'W';
         req->slba = offset;
-        io_uring_prep_writev(sqe, fd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
+        if (req->buf_index >= 0)
+            io_uring_prep_write_fixed(sqe, fd, req->buf, len, offset, req->buf_index);
+        else
+        {
+            req->iov = {.iov_base = req->buf, .iov_len = len};
+            io_uring_prep_writev(sqe, fd, &req->iov, 1, offset);
+        }
+        prep_sqe(ring, sqe, req);
+    }
+
+    // Buffered writes still sit in the page cache. The read is chained behind
+    // writeback of the pages and their eviction, so it goes to the disk; a failed
+    // flush cancels the read.
+    void prep_read_back(io_uring *ring, __u64 offset, __u32 len, request *req) override
+    {
+        static const __u64 page = sysconf(_SC_PAGESIZE);
+        __u64 start = offset / page * page;
+        __u32 span = (offset + len + page - 1) / page * page - start;
+        reserve_sqes(ring, 2 + (io_timeout.tv_sec || io_timeout.tv_nsec ? 2 : 1));
+        io_uring_sqe *sync = io_uring_get_sqe(ring);
+        io_uring_prep_sync_file_range(sync, fd, span, start, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        io_uring_sqe *drop = io_uring_get_sqe(ring);
+        io_uring_prep_fadvise(drop, fd, start, span, POSIX_FADV_DONTNEED);
+        for (io_uring_sqe *sqe : {sync, drop})
+        {
+            sqe->flags = IOSQE_IO_LINK;
+            if (fixed_slot >= 0)
+            {
+                sqe->fd = fixed_slot;
+                sqe->flags |= IOSQE_FIXED_FILE;
+            }
+            io_uring_sqe_set_data(sqe, nullptr);
+        }
+        prep_read(ring, offset, len, req);
+        req->chained = true;
     }
+
     const std::string &get_name() const override { return path; }
     bool is_block_device() const override { return false; }
     size_t get_size() const override { return file_size; }
+    int get_fd() const override { return fd; }
+
+    bool data_extents(__u64 size, std::vector<std::pair<__u64, __u64>> &extents) const override
+    {
+        for (off_t pos = 0; pos < static_cast<off_t>(size);)
+        {
+            off_t data = lseek(fd, pos, SEEK_DATA);
+            if (data < 0 && errno == ENXIO)
+                break;
+            if (data < 0)
+            {
+                extents.clear();
+                return fiemap_extents(size, extents);
+            }
+            off_t hole = lseek(fd, data, SEEK_HOLE);
+            if (hole < 0 || hole > static_cast<off_t>(size))
+                hole = size;
+            extents.emplace_back(data, hole);
+            pos = hole;
+        }
+        return true;
+    }
+
+    int punch_hole(__u64 offset, __u64 len) override
+    {
+        // Beyond the size at open the file is already a hole, e.g. a truncated destination.
+        if (offset >= file_size)
+            return 0;
+        len = std::min<__u64>(len, file_size - offset);
+        return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) < 0 ? -errno : 0;
+    }
+
+    void set_size(__u64 size) override
+    {
+        if (ftruncate(fd, size) < 0)
+            throw std::runtime_error("Failed to resize " + path + ": " + strerror(errno));
+    }
+
+    bool prep_write_zeroes(io_uring *ring, __u64 offset, __u32 len, request *req) override
+    {
+        io_uring_sqe *sqe = get_sqe(ring);
+        req->rw_dir = 'W';
+        req->slba = offset;
+        io_uring_prep_fallocate(sqe, fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+        prep_sqe(ring, sqe, req);
+        return true;
+    }
+
+private:
+    // For filesystems without SEEK_DATA. Unwritten (preallocated) extents read as zeros, so they count as holes.
+    bool fiemap_extents(__u64 size, std::vector<std::pair<__u64, __u64>> &extents) const
+    {
+        constexpr int count = 256;
+        std::vector<char> raw(sizeof(struct fiemap) + count * sizeof(struct fiemap_extent));
+        auto *fm = reinterpret_cast<struct fiemap *>(raw.data());
+        for (__u64 pos = 0; pos < size;)
+        {
+            memset(raw.data(), 0, raw.size());
+            fm->fm_start = pos;
+            fm->fm_length = size - pos;
+            fm->fm_flags = FIEMAP_FLAG_SYNC;
+            fm->fm_extent_count = count;
+            if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0)
+            {
+                logger.debug("FIEMAP on {}: {}", path, strerror(errno));
+                extents.clear();
+                return false;
+            }
+            if (fm->fm_mapped_extents == 0)
+                break;
+            for (__u32 i = 0; i < fm->fm_mapped_extents; i++)
+            {
+                const auto &fe = fm->fm_extents[i];
+                __u64 end = std::min(size, fe.fe_logical + fe.fe_length);
+                pos = fe.fe_logical + fe.fe_length;
+                if (fe.fe_flags & FIEMAP_EXTENT_UNWRITTEN || fe.fe_logical >= end)
+                    continue;
+                if (!extents.empty() && extents.back().second >= fe.fe_logical)
+                    extents.back().second = std::max(extents.back().second, end);
+                else
+                    extents.emplace_back(fe.fe_logical, end);
+            }
+            if (fm->fm_extents[fm->fm_mapped_extents - 1].fe_flags & FIEMAP_EXTENT_LAST)
+                break;
+        }
+        return true;
+    }
+};
+
+class BlockIOHandler : public IOHandler
+{
+    std::string path;
+    int fd;
+    size_t dev_size;
+    __u32 logical_size;
+    __u32 physical_size;
+
+    __u32 align_len(__u32 len) const { return (len + logical_size - 1) / logical_size * logical_size; }
+
+    // Read-modify-write of the last partial sector: the bytes past len are
+    // filled with the current device contents through an aligned bounce buffer.
+    void fill_tail(__u64 offset, __u32 len, __u32 io_len, char *buf)
+    {
+        __u64 tail = offset + io_len - logical_size;
+        __u32 keep = len - (io_len - logical_size);
+        void *bounce;
+        if (posix_memalign(&bounce, logical_size, logical_size))
+            throw std::runtime_error("Failed to allocate bounce buffer");
+        ssize_t ret = pread(fd, bounce, logical_size, tail);
+        if (ret == static_cast<ssize_t>(logical_size))
+            memcpy(buf + len, static_cast<char *>(bounce) + keep, logical_size - keep);
+        free(bounce);
+        if (ret != static_cast<ssize_t>(logical_size))
+            throw std::runtime_error("Failed to read tail sector of " + path);
+    }
+
+public:
+    BlockIOHandler(const std::string &p, int fd) : path(p), fd(fd)
+    {
+        unsigned long long bytes;
+        int lbs;
+        unsigned int pbs;
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0 || ioctl(fd, BLKSSZGET, &lbs) != 0 || ioctl(fd, BLKPBSZGET, &pbs) != 0)
+            throw std::runtime_error("Failed to query block device: " + path);
+        dev_size = bytes;
+        logical_size = lbs;
+        physical_size = std::max<__u32>(pbs, logical_size);
+        logger.debug("{}: FD_TYPE_BLOCK, size {}, logical {}, physical {}", path, dev_size, logical_size, physical_size);
+        valid = true;
+    }
+
+    ~BlockIOHandler()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    void prep_read(io_uring *ring, __u64 offset, __u32 len, request *req) override
+    {
+        io_uring_sqe *sqe = get_sqe(ring);
+        __u32 io_len = align_len(len);
+        req->rw_dir = 'R';
+        req->slba = offset;
+        if (req->buf_index >= 0)
+            io_uring_prep_read_fixed(sqe, fd, req->buf, io_len, offset, req->buf_index);
+        else
+        {
+            req->iov = {.iov_base = req->buf, .iov_len = io_len};
+            io_uring_prep_readv(sqe, fd, &req->iov, 1, offset);
+        }
+        prep_sqe(ring, sqe, req);
+    }
+
+    void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
+    {
+        __u32 io_len = align_len(len);
+        if (io_len != len)
+            fill_tail(offset, len, io_len, req->buf);
+
+        io_uring_sqe *sqe = get_sqe(ring);
+        req->rw_dir = 'W';
+        req->slba = offset;
+        if (req->buf_index >= 0)
+            io_uring_prep_write_fixed(sqe, fd, req->buf, io_len, offset, req->buf_index);
+        else
+        {
+            req->iov = {.iov_base = req->buf, .iov_len = io_len};
+            io_uring_prep_writev(sqe, fd, &req->iov, 1, offset);
+        }
+        prep_sqe(ring, sqe, req);
+    }
+    const std::string &get_name() const override { return path; }
+    bool is_block_device() const override { return true; }
+    size_t get_size() const override { return dev_size; }
+    int get_fd() const override { return fd; }
+    __u32 get_alignment() const override { return physical_size; }
+    bool is_fixed_length() const override { return true; }
+    bool supports_iopoll() const override { return true; }
+
+    // Zeroes the range through discard or Write Zeroes, as the device allows.
+    int punch_hole(__u64 offset, __u64 len) override
+    {
+        return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) < 0 ? -errno : 0;
+    }
+
+    // ZERO_RANGE on a block device issues Write Zeroes, unmapping where the device allows.
+    bool prep_write_zeroes(io_uring *ring, __u64 offset, __u32 len, request *req) override
+    {
+        if (len % logical_size)
+            return false;
+        io_uring_sqe *sqe = get_sqe(ring);
+        req->rw_dir = 'W';
+        req->slba = offset;
+        io_uring_prep_fallocate(sqe, fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, offset, len);
+        prep_sqe(ring, sqe, req);
+        return true;
+    }
 };
 
 enum filetype
@@ -200,27 +631,156 @@ struct nvme_data
     __u32 nsid;
     __u32 lba_shift;
     __u32 lba_size;
-    __u32 lba_ext;
-    __u16 lr;
+    __u32 lba_ext; /* data plus metadata bytes of an extended LBA, 0 if separate */
+    __u16 ms;      /* metadata bytes per LBA */
+    __u64 nsze;    /* namespace size in LBAs */
 };
 
+// How long an admin command may take before it is reported as hung.
+constexpr __u64 ADMIN_TIMEOUT_NS = 10000000000ull;
+
+// One admin command on the controller's admin queue; returns the NVMe status, or -errno.
+Task<int> nvme_admin_passthru(IoContext &ctx, int fd, struct nvme_uring_cmd cmd)
+{
+    co_return co_await ctx.uring_cmd(fd, NVME_URING_CMD_ADMIN, &cmd, sizeof(cmd));
+}
+
+// An admin command raced against a deadline; -ETIMEDOUT if the deadline wins.
+// The loser is cancelled, but a command keeps its buffer until it completes, so
+// the caller drains the ring before releasing it.
+Task<int> nvme_admin_passthru(IoContext &ctx, int fd, struct nvme_uring_cmd cmd, __u64 timeout_ns)
+{
+    auto first = co_await when_any(nvme_admin_passthru(ctx, fd, cmd), ctx.timeout(timeout_ns));
+    io_uring_sqe *sqe = ctx.get_sqe();
+    io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data(sqe, nullptr);
+    co_return first.index() == 0 ? std::get<0>(first) : -ETIMEDOUT;
+}
+
+// Controller character device of a namespace generic device: /dev/ng0n1 -> /dev/nvme0.
+std::string nvme_controller_path(const std::string &ns_path)
+{
+    size_t name = ns_path.rfind('/') + 1;
+    size_t n = ns_path.find('n', name + 2);
+    if (ns_path.compare(name, 2, "ng") != 0 || n == std::string::npos)
+        return "";
+    return ns_path.substr(0, name) + "nvme" + ns_path.substr(name + 2, n - name - 2);
+}
+
 class NvmeIOHandler : public IOHandler
 {
     std::string path;
     int fd;
-    const __u32 lba_size = 512;
     size_t dev_size;
     enum filetype filetype;
-    struct nvme_data nvme_data;
+    struct nvme_data nvme_data = {.lba_shift = 9, .lba_size = 512};
+    bool ns_dev = false;
+    __u32 max_transfer = 0; /* bytes per command, 0: no limit */
+    __u32 max_zeroes = 65536 * 512; /* bytes per Write Zeroes command, 0: no limit */
 
 public:
     NvmeIOHandler(const std::string &p, int fd) : path(p), fd(fd)
     {
         if (get_file_size() != 0)
             throw std::runtime_error("Failed to identify NVMe device: " + path);
+        // Namespace generic devices (/dev/ngXnY) take I/O passthrough; controller devices only admin.
+        int nsid = ioctl(fd, NVME_IOCTL_ID);
+        if (nsid > 0)
+        {
+            ns_dev = true;
+            nvme_data.nsid = nsid;
+        }
+        logger.debug("{}: {} passthrough, nsid {}", path, ns_dev ? "I/O" : "admin", nvme_data.nsid);
+        identify();
         valid = true;
     }
 
+    // Reads the transfer limit from Identify Controller and, on a namespace
+    // device, fills nvme_data from Identify Namespace, both through io_uring
+    // admin passthrough. A namespace generic device takes only I/O commands, so
+    // they go to its controller device; without one, 512-byte LBAs are assumed.
+    void identify()
+    {
+        std::string ctrl = ns_dev ? nvme_controller_path(path) : path;
+        int ctrl_fd = !ns_dev ? fd : ctrl.empty() ? -1 : open(ctrl.c_str(), O_RDONLY);
+        if (ctrl_fd < 0)
+        {
+            logger.warning("{}: no controller device to identify, assuming 512-byte LBAs", path);
+            return;
+        }
+        auto id_ctrl = std::make_unique<struct nvme_id_ctrl>();
+        auto id = std::make_unique<struct nvme_id_ns>();
+        int ctrl_res, ns_res = 0;
+        {
+            IoContext ctx(1, IORING_SETUP_SQE128 | IORING_SETUP_CQE32);
+            auto identify_cmd = [&](void *buf, __u32 len, __u32 nsid, __u32 cns)
+            {
+                struct nvme_uring_cmd cmd = {};
+                cmd.opcode = nvme_admin_identify;
+                cmd.nsid = nsid;
+                cmd.addr = reinterpret_cast<__u64>(buf);
+                cmd.data_len = len;
+                cmd.cdw10 = cns;
+                int res = ctx.run(nvme_admin_passthru(ctx, ctrl_fd, cmd, ADMIN_TIMEOUT_NS));
+                if (res == -ETIMEDOUT)
+                    logger.warning("{}: Identify did not complete in {} s, waiting for the controller to abort it", ctrl, ADMIN_TIMEOUT_NS / 1000000000);
+                ctx.drain();
+                return res;
+            };
+            ctrl_res = identify_cmd(id_ctrl.get(), sizeof(*id_ctrl), 0, NVME_IDENTIFY_CNS_CTRL);
+            if (ns_dev)
+                ns_res = identify_cmd(id.get(), sizeof(*id), nvme_data.nsid, NVME_IDENTIFY_CNS_NS);
+        }
+        if (ns_dev)
+            close(ctrl_fd);
+        auto status = [](int res)
+        { return res < 0 ? std::string(strerror(-res)) : std::format("NVMe status {:#x}", res); };
+        if (ctrl_res != 0)
+            throw std::runtime_error(std::format("Identify Controller failed on {}: {}", ctrl, status(ctrl_res)));
+        if (ns_res != 0)
+            throw std::runtime_error(std::format("Identify Namespace {} failed on {}: {}", nvme_data.nsid, ctrl, status(ns_res)));
+
+        // MDTS is a power of two in units of the minimum memory page size, taken as 4 KiB; 0 means no limit.
+        if (id_ctrl->mdts)
+            max_transfer = 4096u << std::min<__u8>(id_ctrl->mdts, 18);
+        if (!ns_dev)
+        {
+            logger.debug("{}: max transfer {}", path, max_transfer);
+            return;
+        }
+
+        // FLBAS bits 3:0 and 6:5 select the LBA format; bit 4 puts metadata at the end of each LBA.
+        __u8 format = (id->flbas & 0xf) | (id->nlbaf > 16 ? (id->flbas >> 1) & 0x30 : 0);
+        nvme_data.lba_shift = id->lbaf[format].ds;
+        nvme_data.lba_size = 1u << nvme_data.lba_shift;
+        nvme_data.ms = le16toh(id->lbaf[format].ms);
+        nvme_data.lba_ext = nvme_data.ms && (id->flbas & 0x10) ? nvme_data.lba_size + nvme_data.ms : 0;
+        nvme_data.nsze = le64toh(id->nsze);
+        dev_size = nvme_data.nsze * lba_bytes();
+        if (nvme_data.ms && !nvme_data.lba_ext)
+            logger.warning("{}: {} bytes of separate metadata per LBA are not copied", path, nvme_data.ms);
+
+        // The kernel maps a passthrough command into a single request, so the
+        // block queue's limit applies as well, and NLB is a 16-bit field.
+        std::string name = path.substr(path.rfind('/') + 1);
+        std::ifstream hw("/sys/block/nvme" + name.substr(2) + "/queue/max_hw_sectors_kb");
+        __u64 hw_kb = 0;
+        if (hw >> hw_kb && hw_kb)
+            max_transfer = max_transfer ? std::min<__u64>(max_transfer, hw_kb * 1024) : hw_kb * 1024;
+        __u64 nlb_limit = 65536ull * lba_bytes();
+        max_transfer = max_transfer ? std::min<__u64>(max_transfer, nlb_limit) : nlb_limit;
+        max_zeroes = nlb_limit > UINT32_MAX ? 0 : nlb_limit;
+        max_transfer = max_transfer / lba_bytes() * lba_bytes();
+        logger.debug("{}: LBA format {}, {} + {} bytes{}, {} LBAs, max transfer {}", path, format, nvme_data.lba_size, nvme_data.ms,
+                     nvme_data.lba_ext ? " extended" : "", nvme_data.nsze, max_transfer);
+    }
+
+    // Bytes per LBA as transferred, metadata included for an extended format.
+    __u32 lba_bytes() const { return nvme_data.lba_ext ? nvme_data.lba_ext : nvme_data.lba_size; }
+
+    // Extended LBA sizes are not powers of two.
+    __u64 to_lba(__u64 bytes) const { return nvme_data.lba_ext ? bytes / nvme_data.lba_ext : bytes >> nvme_data.lba_shift; }
+
     ~NvmeIOHandler()
     {
         if (fd >= 0)
@@ -229,42 +789,128 @@ public:
 
     void prep_read(io_uring *ring, __u64 offset, __u32 len, request *req) override
     {
-        io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        auto cmd = (struct nvme_uring_cmd *)&sqe->cmd;
+        prep_rw_cmd(ring, offset, len, req, false);
+    }
+
+    void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
+    {
+        prep_rw_cmd(ring, offset, len, req, true);
+    }
+
+    // A tail shorter than a whole LBA is padded out to one: a write sends zeros
+    // past len, a read fills the buffer past len. The buffer has room, as the
+    // block size is a multiple of the LBA size.
+    void prep_rw_cmd(io_uring *ring, __u64 offset, __u32 len, request *req, bool write)
+    {
+        __u32 io_len = ns_dev ? (len + lba_bytes() - 1) / lba_bytes() * lba_bytes() : len;
+        if (write && io_len != len)
+            memset(req->buf + len, 0, io_len - len);
+        req->rw_dir = write ? 'W' : 'R';
+        auto prep = [&](__u64 at, __u32 n, request *r)
+        { prep_cmd(ring, at, n, r, write); };
+        prep_split(offset, io_len, max_transfer, req, prep);
+        req->len = len;
+    }
+
+    // Queues an I/O through prep as commands of at most limit bytes (0: no
+    // limit). The commands of a split I/O complete as one through req, which
+    // takes the status of the first part that fails.
+    template <class Prep>
+    void prep_split(__u64 offset, __u32 len, __u32 limit, request *req, Prep prep)
+    {
+        req->slba = offset;
+        req->len = len;
+        req->passthru = true;
+        if (!limit || len <= limit)
+        {
+            req->parts.clear();
+            prep(offset, len, req);
+            return;
+        }
+        req->parts.resize((len + limit - 1) / limit);
+        req->pending = req->parts.size();
+        req->res = 0;
+        req->submit_ns = time_get_ns();
+        for (size_t i = 0; i < req->parts.size(); i++)
+        {
+            request &part = req->parts[i];
+            __u32 at = i * limit;
+            part.buf = req->buf + at;
+            part.buf_index = req->buf_index;
+            part.sqe_flags = req->sqe_flags;
+            part.lr = req->lr;
+            part.passthru = true;
+            part.parent = req;
+            prep(offset + at, std::min(limit, len - at), &part);
+        }
+    }
+
+    void prep_cmd(io_uring *ring, __u64 offset, __u32 len, request *req, bool write)
+    {
+        io_uring_sqe *sqe = get_sqe(ring);
+        auto cmd = (struct nvme_uring_cmd *)sqe->cmd;
         memset(cmd, 0, sizeof(struct nvme_uring_cmd));
-        cmd->opcode = CUST_CONTROLLER_TO_HOST;
         cmd->nsid = nvme_data.nsid;
-        cmd->addr = (__u64)req->buf.get();
+        cmd->addr = (__u64)req->buf;
         cmd->data_len = len;
-        cmd->cdw10 = offset & 0xffffffff;
-        cmd->cdw11 = offset >> 32;
-        cmd->cdw12 = len | (nvme_data.lr << 31);
-        cmd->cdw15 = NAMESPACE_READ_COMMAND;
+        if (ns_dev)
+        {
+            __u64 slba = to_lba(offset);
+            cmd->opcode = write ? nvme_cmd_write : nvme_cmd_read;
+            cmd->cdw10 = slba & 0xffffffff;
+            cmd->cdw11 = slba >> 32;
+            cmd->cdw12 = (to_lba(len) - 1) | (req->lr << 31);
+        }
+        else
+        {
+            cmd->opcode = write ? CUST_HOST_TO_CONTROLLER : CUST_CONTROLLER_TO_HOST;
+            cmd->cdw10 = offset & 0xffffffff;
+            cmd->cdw11 = offset >> 32;
+            cmd->cdw12 = len | (req->lr << 31);
+            cmd->cdw15 = write ? NAMESPACE_WRITE_COMMAND : NAMESPACE_READ_COMMAND;
+        }
 
-        req->rw_dir = 'R';
-        req->slba = offset;
         io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, req);
+        sqe->cmd_op = ns_dev ? NVME_URING_CMD_IO : NVME_URING_CMD_ADMIN;
+        set_fixed_buffer(sqe, req);
+        prep_sqe(ring, sqe, req);
     }
 
-    void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
+    // Write Zeroes with DEAC, so the drive may deallocate instead of writing.
+    // It moves no data, so only its 16-bit NLB field limits a command.
+    bool prep_write_zeroes(io_uring *ring, __u64 offset, __u32 len, request *req) override
     {
-        io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (!ns_dev || len % lba_bytes())
+            return false;
+        req->rw_dir = 'W';
+        auto prep = [&](__u64 at, __u32 n, request *r)
+        { prep_zeroes_cmd(ring, at, n, r); };
+        prep_split(offset, len, max_zeroes, req, prep);
+        return true;
+    }
+
+    void prep_zeroes_cmd(io_uring *ring, __u64 offset, __u32 len, request *req)
+    {
+        io_uring_sqe *sqe = get_sqe(ring);
         auto cmd = (struct nvme_uring_cmd *)sqe->cmd;
         memset(cmd, 0, sizeof(struct nvme_uring_cmd));
-        cmd->opcode = CUST_HOST_TO_CONTROLLER;
+        __u64 slba = to_lba(offset);
+        cmd->opcode = nvme_cmd_write_zeroes;
         cmd->nsid = nvme_data.nsid;
-        cmd->addr = (__u64)req->buf.get();
-        cmd->data_len = len;
-        cmd->cdw10 = offset & 0xffffffff;
-        cmd->cdw11 = offset >> 32;
-        cmd->cdw12 = len | (nvme_data.lr << 31);
-        cmd->cdw15 = NAMESPACE_WRITE_COMMAND;
+        cmd->cdw10 = slba & 0xffffffff;
+        cmd->cdw11 = slba >> 32;
+        cmd->cdw12 = (to_lba(len) - 1) | (1 << 25) | (req->lr << 31);
 
-        req->rw_dir = 'W';
-        req->slba = offset;
         io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, req);
+        sqe->cmd_op = NVME_URING_CMD_IO;
+        sqe->uring_cmd_flags = 0;
+        prep_sqe(ring, sqe, req);
+    }
+
+    void set_fixed_buffer(io_uring_sqe *sqe, request *req)
+    {
+        sqe->uring_cmd_flags = (req->buf_index >= 0) ? IORING_URING_CMD_FIXED : 0;
+        sqe->buf_index = (req->buf_index >= 0) ? req->buf_index : 0;
     }
 
     int get_file_size()
@@ -296,145 +942,1603 @@ public:
     const std::string &get_name() const override { return path; }
     bool is_block_device() const override { return true; }
     size_t get_size() const override { return dev_size; }
+    int get_fd() const override { return fd; }
+    bool is_fixed_length() const override { return true; }
+    __u32 get_alignment() const override { return ns_dev ? lba_bytes() : 1; }
+    __u32 get_max_transfer() const override { return max_transfer; }
+    bool supports_iopoll() const override { return ns_dev; }
+    // A failed command completes with its positive NVMe status, so a chain runs on.
+    bool errors_break_links() const override { return false; }
 };
 
-task read_and_write_block(struct io_uring *ring, IOHandler &src, IOHandler &dest, __u64 offset, __u32 block_size, std::function<void()> on_complete)
+enum fixed_file_mode
 {
-    request req;
-    req.buf = std::make_unique<char[]>(block_size);
-
-    try
-    {
-        logger.debug("before queue_rw_pair read: offset: {}", offset);
-        src.prep_read(ring, offset, block_size, &req);
-        int bytes_read = co_await io_awaitable(&req);
-        logger.debug("complete queue_rw_pair read: offset: {}", offset);
+    FIXED_FILES_NONE = 0, /* plain fds */
+    FIXED_FILES_REGISTER, /* io_uring_register_files() on the opened fds */
+    FIXED_FILES_DIRECT,   /* reopen into sparse fixed slots with openat_direct */
+};
 
-        if (dest.is_valid())
-        {
-            dest.prep_write(ring, offset, bytes_read, &req);
-            co_await io_awaitable(&req);
-            logger.debug("complete queue_rw_pair write: offset {}", offset);
-        }
-    }
-    catch (const std::runtime_error &e)
-    {
-        logger.error("Error at offset {}: {}", offset, e.what());
-    }
-    on_complete();
+fixed_file_mode parse_fixed_file_mode(const std::string &mode)
+{
+    if (mode == "none")
+        return FIXED_FILES_NONE;
+    if (mode == "register")
+        return FIXED_FILES_REGISTER;
+    if (mode == "direct")
+        return FIXED_FILES_DIRECT;
+    throw std::runtime_error("Unknown fixed-files mode: " + mode);
 }
 
-task run_admin_identify(struct io_uring *ring, const std::string &dev_path, std::function<void()> on_complete)
+void register_handler_files(struct io_uring *ring, const std::vector<IOHandler *> &handlers, fixed_file_mode mode)
 {
-    int fd = open(dev_path.c_str(), O_RDONLY);
-    if (fd < 0)
+    if (mode == FIXED_FILES_NONE)
+        return;
+
+    std::vector<int> fds;
+    for (auto *h : handlers)
+        fds.push_back(h->get_fd());
+
+    if (mode == FIXED_FILES_REGISTER)
     {
-        on_complete();
-        throw std::runtime_error("Failed to open device for admin cmd: " + dev_path);
+        int ret = io_uring_register_files(ring, fds.data(), fds.size());
+        if (ret < 0)
+            throw std::runtime_error("io_uring_register_files failed: " + std::string(strerror(-ret)));
+        return;
     }
 
-    request req;
-    req.buf = std::make_unique<char[]>(4096);
-
-    try
+    int ret = io_uring_register_files_sparse(ring, fds.size());
+    if (ret < 0)
+        throw std::runtime_error("io_uring_register_files_sparse failed: " + std::string(strerror(-ret)));
+    for (size_t slot = 0; slot < handlers.size(); slot++)
     {
+        if (fds[slot] < 0)
+            continue;
+        // Reopen with the access mode of the plain fd; O_CREAT/O_TRUNC were already applied.
+        int flags = fcntl(fds[slot], F_GETFL) & (O_ACCMODE | O_DIRECT);
+        reserve_sqes(ring, 1);
         io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        auto cmd = (struct nvme_uring_cmd *)sqe->cmd;
-        memset(cmd, 0, sizeof(struct nvme_uring_cmd));
-        cmd->opcode = nvme_admin_identify;
-        cmd->nsid = 0;
-        cmd->addr = (__u64)req.buf.get();
-        cmd->data_len = 4096;
-        cmd->cdw10 = NVME_IDENTIFY_CNS_CTRL;
+        io_uring_prep_openat_direct(sqe, AT_FDCWD, handlers[slot]->get_name().c_str(), flags, 0, slot);
+        io_uring_sqe_set_data(sqe, nullptr);
 
-        io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, &req);
-
-        logger.debug("Submitting Identify Controller command...");
-        co_await io_awaitable(&req);
-        logger.debug("Admin command completed.");
-
-        std::string model_number(req.buf.get() + 4, 40);
-        model_number.erase(model_number.find_last_not_of(' ') + 1);
-        logger.debug(" > Model Number: {}", model_number);
-    }
-    catch (const std::runtime_error &e)
-    {
-        logger.error("Admin command failed: {}", e.what());
+        struct io_uring_cqe *cqe;
+        io_uring_submit(ring);
+        ret = io_uring_wait_cqe(ring, &cqe);
+        if (ret == 0)
+        {
+            ret = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+        }
+        if (ret < 0)
+            throw std::runtime_error("openat_direct failed: " + handlers[slot]->get_name() + ": " + strerror(-ret));
     }
-    close(fd);
-    on_complete();
 }
 
-void run_copy_logic(IOHandler &src, IOHandler &dest, __u64 insize, int bs, int qd)
+// Slots are the handler's index, identical in every ring, so assign them once before any ring runs.
+void assign_fixed_slots(const std::vector<IOHandler *> &handlers, fixed_file_mode mode)
 {
-    struct io_uring ring;
-    int ring_flags;
-    ring_flags = 0;
-    ring_flags |= IORING_SETUP_SQE128;
-    ring_flags |= IORING_SETUP_CQE32;
+    if (mode == FIXED_FILES_NONE)
+        return;
+    for (size_t slot = 0; slot < handlers.size(); slot++)
+        if (handlers[slot]->get_fd() >= 0)
+            handlers[slot]->set_fixed_slot(slot);
+}
 
-    io_uring_queue_init(qd, &ring, ring_flags);
-    if (dest.is_valid())
-        logger.info("Copying {} bytes from {} to {}", insize, src.get_name(), dest.get_name());
-    else
-        logger.info("Copying {} bytes from {}", insize, src.get_name());
+// fio-style workload against a single target instead of a copy.
+struct workload_spec
+{
+    bool enabled = false;
+    bool random = false;
+    double zipf_theta = 0; /* random offsets follow zipf(theta), 0: uniform */
+    int read_pct = 100;
+    std::vector<std::pair<__u32, __u32>> bssplit; /* block size, weight */
+};
 
-    int inflight = 0;
-    int ret = 0;
-    int iocount = 0;
-    __u64 offset = 0;
-    __u64 progress = 0;
-    __u64 time_tag = time_get_ns();
+struct copy_options
+{
+    int bs;
+    int qd;
+    fixed_file_mode files;
+    bool link;
+    int threads;
+    __u64 chunk;
+    bool iopoll;
+    bool sqpoll;
+    unsigned sq_idle;
+    int sq_cpu;
+    bool sq_shared;
+    int sq_wq_fd = -1; /* ring whose SQ poll thread new rings attach to */
+    bool adaptive;
+    int min_qd;
+    std::string json;
+    __u64 run_ns;      /* --time, 0 runs until the range is copied once */
+    __u64 interval_ns; /* --interval, 0 disables per-interval stats */
+    workload_spec workload;
+    bool verify;
+    bool sparse;        /* copy only the data extents of a sparse source */
+    bool zero_detect;   /* write all-zero blocks as hole punch / Write Zeroes */
+    int read_qd;        /* reads in flight per ring */
+    int write_qd;       /* blocks being written per ring */
+    int buffers;        /* blocks per ring, read-ahead queue included */
+    std::string digest; /* per-chunk digest file, empty: no digest stage */
+    int hash_threads;
+    __u64 io_timeout_ns;    /* --io-timeout, 0: I/O has no deadline */
+    __u8 lr;                /* NVMe Limited Retry when failures are not retried */
+    int retries;            /* attempts after the first one of a failed read or write */
+    __u64 retry_backoff_ns; /* wait before the first retry, doubled per retry */
+    std::string bad_ranges; /* file listing the ranges that failed every attempt */
+};
 
-    while (offset < insize)
-    {
-        while (inflight < qd && offset < insize)
-        {
-            __u64 this_size = (insize - offset < static_cast<__u64>(bs)) ? (insize - offset) : bs;
-            read_and_write_block(&ring, src, dest, offset, this_size, [&]()
-                                 { inflight--; });
+struct copy_stats
+{
+    // Read by the stats tick on another ring while this one runs.
+    std::atomic<__u64> iocount{0};
+    std::atomic<__u64> progress{0};
+    __u64 steals = 0;
+    __u64 verified = 0;
+    __u64 verify_errors = 0;
+    __u64 zero_blocks = 0;
+    __u64 timeouts = 0;  /* I/O cancelled by its linked timeout */
+    __u64 cancelled = 0; /* I/O cancelled by a job cancel */
+    __u64 retried = 0;   /* retry attempts */
+    __u64 recovered = 0; /* I/Os that succeeded on a retry */
+    std::vector<std::pair<__u64, __u32>> bad; /* offset and length of I/Os that failed every attempt */
+    LatencyHistogram read_lat;
+    LatencyHistogram write_lat;
+};
 
-            logger.debug("read_and_write_block called with offset: {}, size: {}, inflight: {}", offset, this_size, inflight);
-            offset += this_size;
-            progress += this_size;
-            inflight++;
-            iocount++;
-        }
+#define VERIFY_MAGIC 0x594649524556434full /* "COVERIFY" */
 
-        io_uring_submit(&ring);
-        int wait_count = (offset < insize && inflight > 0) ? 1 : inflight;
-        for (int i = 0; i < wait_count; ++i)
-        {
+// Header at the start of every verify unit written by a --verify workload.
+struct verify_header
+{
+    __u64 magic;
+    __u64 offset;     /* byte offset of the unit on the target */
+    __u32 generation; /* writes of this unit in the writing run, mod 256 */
+    __u32 seed;       /* run seed the payload was generated from */
+    __u32 len;        /* verify unit size */
+    __u32 crc;        /* crc32c of the unit with this field zeroed */
+};
+
+// Workload blocks are split into fixed verify units, so a read of any size
+// and alignment that the workload issues can check each unit on its own.
+// Mixed workloads also track per-unit generations to catch writes that were
+// lost or landed elsewhere when they are read back within the same run.
+class block_verifier
+{
+    __u32 unit;
+    __u32 seed;
+    std::unique_ptr<std::atomic<__u8>[]> issued;
+    std::unique_ptr<std::atomic<__u8>[]> committed;
+
+    static __u32 unit_crc(const char *p, __u32 len)
+    {
+        __u32 crc = Crc32c::compute(0, p, offsetof(verify_header, crc));
+        return Crc32c::compute(crc, p + sizeof(verify_header), len - sizeof(verify_header));
+    }
+
+public:
+    block_verifier(__u64 insize, __u32 unit, __u32 seed, bool track) : unit(unit), seed(seed)
+    {
+        if (!track)
+            return;
+        __u64 units = insize / unit + 1;
+        issued.reset(new std::atomic<__u8>[units]());
+        committed.reset(new std::atomic<__u8>[units]());
+    }
+
+    __u32 get_unit() const { return unit; }
+
+    // Fills a block about to be written with headers and a payload derived from the seed.
+    void stamp(char *buf, __u64 offset, __u32 len)
+    {
+        for (__u32 pos = 0; pos + unit <= len; pos += unit)
+        {
+            char *p = buf + pos;
+            __u64 at = offset + pos;
+            __u32 gen = issued ? static_cast<__u8>(issued[at / unit].fetch_add(1, std::memory_order_relaxed) + 1) : 1;
+            __u64 x = (seed ^ (at * 0x9e3779b97f4a7c15ull) ^ gen) | 1;
+            for (__u32 i = sizeof(verify_header); i + 8 <= unit; i += 8)
+            {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                memcpy(p + i, &x, 8);
+            }
+            verify_header hdr{VERIFY_MAGIC, at, gen, seed, unit, 0};
+            memcpy(p, &hdr, sizeof(hdr));
+            hdr.crc = unit_crc(p, unit);
+            memcpy(p + offsetof(verify_header, crc), &hdr.crc, sizeof(hdr.crc));
+        }
+    }
+
+    // Marks the generations stamped into a completed write as the ones on the media.
+    void written(const char *buf, __u64 offset, __u32 len)
+    {
+        if (!committed)
+            return;
+        for (__u32 pos = 0; pos + unit <= len; pos += unit)
+        {
+            __u32 gen;
+            memcpy(&gen, buf + pos + offsetof(verify_header, generation), sizeof(gen));
+            auto &c = committed[(offset + pos) / unit];
+            __u8 cur = c.load(std::memory_order_relaxed);
+            while (static_cast<__u8>(gen - cur - 1) < 127 && !c.compare_exchange_weak(cur, gen, std::memory_order_relaxed))
+                ;
+        }
+    }
+
+    // Generations a read issued now must see at least, 0 for units not written in this run.
+    std::vector<__u8> expected(__u64 offset, __u32 len) const
+    {
+        std::vector<__u8> gens;
+        if (committed)
+            for (__u32 pos = 0; pos + unit <= len; pos += unit)
+                gens.push_back(committed[(offset + pos) / unit].load(std::memory_order_relaxed));
+        return gens;
+    }
+
+    // Returns why the block failed, or an empty string if every unit checks out.
+    std::string check(const char *buf, __u64 offset, __u32 len, const std::vector<__u8> &expect) const
+    {
+        for (__u32 pos = 0, i = 0; pos + unit <= len; pos += unit, i++)
+        {
+            // With tracking, units this run has not written hold data of unknown origin.
+            if (i < expect.size() && !expect[i])
+                continue;
+            const char *p = buf + pos;
+            __u64 at = offset + pos;
+            verify_header hdr;
+            memcpy(&hdr, p, sizeof(hdr));
+            if (hdr.magic != VERIFY_MAGIC)
+                return std::format("no verify header at {}", at);
+            if (hdr.offset != at || hdr.len != unit)
+                return std::format("unit at {} holds {} bytes written for offset {}", at, hdr.len, hdr.offset);
+            if (unit_crc(p, unit) != hdr.crc)
+                return std::format("crc32c mismatch at {}", at);
+            if (i < expect.size() && static_cast<__u8>(hdr.generation - expect[i]) >= 128)
+                return std::format("stale data at {}: generation {}, expected {}", at, hdr.generation, expect[i]);
+        }
+        return {};
+    }
+};
+
+// Hash threads for the digest stage. A finished hash is posted to the ring that
+// queued it with IORING_OP_MSG_RING, so it completes like any other I/O there.
+class hash_pool
+{
+    struct job
+    {
+        int ring_fd;
+        request *req;
+        const char *buf;
+        __u32 len;
+        __u32 *out;
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<job> jobs;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+
+    void run(int id)
+    {
+        struct io_uring ring;
+        int ret = io_uring_queue_init(8, &ring, 0);
+        if (ret < 0)
+        {
+            logger.error("Hash thread {}: io_uring_queue_init: {}", id, strerror(-ret));
+            std::abort();
+        }
+        for (;;)
+        {
+            job j;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this]
+                        { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    break;
+                j = jobs.front();
+                jobs.pop_front();
+            }
+            *j.out = Crc32c::compute(0, j.buf, j.len);
+
+            io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_msg_ring(sqe, j.ring_fd, j.len, reinterpret_cast<__u64>(static_cast<IoCompletion *>(j.req)), 0);
+            io_uring_sqe_set_data(sqe, nullptr);
+            io_uring_submit_and_wait(&ring, 1);
             struct io_uring_cqe *cqe;
-            ret = io_uring_wait_cqe(&ring, &cqe);
+            io_uring_peek_cqe(&ring, &cqe);
+            ret = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            // The copy coroutine waits for this message; without it the copy cannot finish.
             if (ret < 0)
             {
-                if (-ret != EAGAIN)
-                    logger.error("io_uring_wait_cqe: {}", strerror(-ret));
-                inflight--;
-                continue;
+                logger.error("Hash thread {}: msg_ring: {}", id, strerror(-ret));
+                std::abort();
             }
+        }
+        io_uring_queue_exit(&ring);
+    }
 
-            auto *req = static_cast<request *>(io_uring_cqe_get_data(cqe));
-            if (req)
+public:
+    explicit hash_pool(int nthreads)
+    {
+        for (int i = 0; i < nthreads; i++)
+            threads.emplace_back([this, i]
+                                 { run(i); });
+    }
+
+    ~hash_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    void submit(int ring_fd, request *req, const char *buf, __u32 len, __u32 *out)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            jobs.push_back({ring_fd, req, buf, len, out});
+        }
+        cv.notify_one();
+    }
+};
+
+// Merkle-style copy digest: a crc32c leaf per block, a digest per chunk over
+// its leaves, and an overall digest over the chunk digests.
+class digest_stage
+{
+    __u32 block_size;
+    std::vector<__u32> leaves;
+    std::unique_ptr<hash_pool> pool;
+
+public:
+    digest_stage(__u64 insize, __u32 block_size, int nthreads) : block_size(block_size), leaves(insize / block_size + 1)
+    {
+        // Blocks skipped as holes hash as zeros, so sparse and full copies share a digest.
+        std::vector<char> zeros(block_size);
+        std::fill(leaves.begin(), leaves.end(), Crc32c::compute(0, zeros.data(), block_size));
+        if (insize % block_size)
+            leaves[insize / block_size] = Crc32c::compute(0, zeros.data(), insize % block_size);
+
+        struct io_uring_probe *probe = io_uring_get_probe();
+        bool msg_ring = probe && io_uring_opcode_supported(probe, IORING_OP_MSG_RING);
+        if (probe)
+            io_uring_free_probe(probe);
+        if (nthreads > 0 && !msg_ring)
+            logger.warning("IORING_OP_MSG_RING unsupported, hashing on the copy threads");
+        else if (nthreads > 0)
+            pool = std::make_unique<hash_pool>(nthreads);
+    }
+
+    // Hashes a block, inline or on the pool. Returns true if req completes on the ring later.
+    bool start(struct io_uring *ring, request *req, const char *buf, __u32 len, __u64 offset)
+    {
+        __u32 &leaf = leaves[offset / block_size];
+        if (!pool)
+        {
+            leaf = Crc32c::compute(0, buf, len);
+            return false;
+        }
+        req->rw_dir = 'H';
+        pool->submit(ring->ring_fd, req, buf, len, &leaf);
+        return true;
+    }
+
+    __u32 write(const std::string &path, __u64 insize, __u64 chunk_size)
+    {
+        std::ofstream out(path);
+        if (!out)
+            throw std::runtime_error("Failed to open digest file: " + path);
+        out << "# crc32c block " << block_size << " chunk " << chunk_size << "\n";
+        std::vector<__u32> chunks;
+        __u64 per_chunk = chunk_size / block_size;
+        for (__u64 start = 0; start < insize; start += chunk_size)
+        {
+            __u64 first = start / block_size;
+            __u64 count = std::min(per_chunk, (insize - start + block_size - 1) / block_size);
+            chunks.push_back(Crc32c::compute(0, &leaves[first], count * sizeof(__u32)));
+            out << std::format("{} {} {:08x}\n", start, std::min(chunk_size, insize - start), chunks.back());
+        }
+        __u32 total = Crc32c::compute(0, chunks.data(), chunks.size() * sizeof(__u32));
+        out << std::format("total {:08x}\n", total);
+        return total;
+    }
+};
+
+// Separate inflight limits for the reads and the writes of one ring. Blocks
+// that are read but not yet written wait in between, bounded by the ring's
+// buffers, so reads run ahead while a slow destination drains.
+struct copy_window
+{
+    ring_semaphore reads;
+    ring_semaphore writes;
+};
+
+// Reads one destination's copy of a block back and compares it with the source crc.
+Task<> verify_block(IoContext &ctx, IOHandler &dest, request &chk, __u64 offset, __u32 len, __u32 crc, copy_window &window, copy_stats &stats)
+{
+    auto read_slot = co_await window.reads.acquire();
+    dest.prep_read_back(ctx.ring(), offset, len, &chk);
+    co_await ctx.wait(chk);
+    io_result(chk);
+    stats.verified++;
+    if (Crc32c::compute(0, chk.buf, len) != crc)
+    {
+        stats.verify_errors++;
+        logger.error("Verify failed at offset {} of {}: read-back crc32c mismatch", offset, dest.get_name());
+    }
+}
+
+// Limited Retry of an I/O's first attempt. With retries on, the drive gives up
+// quickly and the retries decide how hard to try.
+__u8 first_lr(const copy_options &opts)
+{
+    return opts.retries ? 1 : opts.lr;
+}
+
+// Waits ns on the ring without holding an I/O slot. The timeout completes on a
+// request, like everything on a copy ring, for the ring's completion hook.
+Task<> backoff(IoContext &ctx, __u64 ns)
+{
+    request t;
+    struct __kernel_timespec ts = {.tv_sec = static_cast<long long>(ns / 1000000000), .tv_nsec = static_cast<long long>(ns % 1000000000)};
+    io_uring_sqe *sqe = ctx.get_sqe();
+    io_uring_prep_timeout(sqe, &ts, 0, 0);
+    io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(&t));
+    co_await ctx.wait(t);
+}
+
+// Completes one block I/O under the retry policy. prep queues it on req; with
+// issued set, req holds the completion of a first attempt already made. The
+// first attempt fails fast under Limited Retry, so healthy regions keep their
+// throughput; each retry waits out a doubling backoff and lets the drive apply
+// all of its error recovery. An I/O that fails every attempt is recorded as a
+// bad range and its last error rethrown.
+template <class Prep>
+Task<int> retry_io(IoContext &ctx, request &req, Prep prep, __u64 offset, __u32 len, const copy_options &opts, copy_stats &stats, bool issued = false)
+{
+    std::exception_ptr last_error;
+    for (int attempt = 0;; attempt++)
+    {
+        if (attempt || !issued)
+        {
+            req.lr = attempt ? 0 : first_lr(opts);
+            prep();
+        }
+        try
+        {
+            if (attempt || !issued)
+                co_await ctx.wait(req);
+            int res = io_result(req);
+            if (attempt)
             {
-                req->cqe_res = cqe->res;
-                req->handle.resume();
+                stats.recovered++;
+                logger.info("Offset {} recovered on retry {}", offset, attempt);
             }
-            io_uring_cqe_seen(&ring, cqe);
-            logger.debug("Processed CQEs, inflight: {}", inflight);
+            co_return res;
+        }
+        catch (const std::runtime_error &e)
+        {
+            if (cancel_requested.load(std::memory_order_relaxed))
+                throw;
+            // Do Not Retry: the command would fail the same way again.
+            if (attempt >= opts.retries || (req.passthru && req.res > 0 && NvmeStatus(req.res).dnr()))
+            {
+                stats.bad.emplace_back(offset, len);
+                throw;
+            }
+            logger.warning("Retrying offset {} ({}), attempt {} of {}", offset, e.what(), attempt + 2, opts.retries + 1);
+            last_error = std::current_exception();
         }
+        if (opts.retry_backoff_ns)
+            co_await backoff(ctx, opts.retry_backoff_ns << std::min(attempt, 16));
+        // Ctrl-C cuts the backoff short; a retry issued now could hang the drain.
+        if (cancel_requested.load(std::memory_order_relaxed))
+            std::rethrow_exception(last_error);
+        stats.retried++;
+    }
+}
+
+Task<> read_and_write_block(IoContext &ctx, BufferPool &pool, IOHandler &src, const std::vector<IOHandler *> &dests, __u64 offset, __u32 block_size, const copy_options &opts, copy_window &window, digest_stage *digest, copy_stats &stats)
+{
+    request req, hash;
+    pool.acquire(&req);
+    bool verify = opts.verify && !dests.empty();
+    std::vector<request> chk(verify ? dests.size() : 0);
+    for (auto &c : chk)
+        pool.acquire(&c);
+    __u32 written = block_size;
+
+    try
+    {
+        // A tail block that needs read-modify-write on the destination cannot be chained,
+        // a chain would serialise the writes of a fan-out, its SQEs cannot each
+        // carry a linked timeout, a failed chain is not retried, and the parts of
+        // a split command are not chained. A source whose failed reads do not
+        // break the chain would have stale buffer contents written, and a
+        // chained write goes out before the data can be checked for zeroes. A file
+        // block is chained if it lay within the file at open; should the file
+        // have shrunk since, the short read breaks the chain and fails the block.
+        auto single = [&](IOHandler *h)
+        { return !h->get_max_transfer() || block_size <= h->get_max_transfer(); };
+        if (opts.link && !opts.io_timeout_ns && !opts.retries && !opts.zero_detect && dests.size() == 1 && src.errors_break_links() &&
+            (src.is_fixed_length() || offset + block_size <= src.get_size()) && block_size % dests[0]->get_alignment() == 0 && single(&src) && single(dests[0]))
+        {
+            auto read_slot = co_await window.reads.acquire();
+            auto write_slot = co_await window.writes.acquire();
+
+            // Read and write complete as one group, whichever CQE is reaped
+            // last. Both SQEs go in one submission, or the chain would break.
+            reserve_sqes(ctx.ring(), 2);
+            request rd, group;
+            rd.buf = req.buf;
+            rd.buf_index = req.buf_index;
+            rd.sqe_flags = IOSQE_IO_LINK;
+            rd.lr = req.lr = opts.lr;
+            src.prep_read(ctx.ring(), offset, block_size, &rd);
+            dests[0]->prep_write(ctx.ring(), offset, block_size, &req);
+            rd.parent = req.parent = &group;
+            group.pending = 2;
+            co_await ctx.wait_group(group);
+
+            // A failed read is the reason for a cancelled write, so report it first.
+            io_result(rd);
+            io_result(req);
+            logger.debug("complete linked read/write: offset {}", offset);
+
+            // The chain leaves no gap between read and write to hash in.
+            if (digest && digest->start(ctx.ring(), &hash, req.buf, block_size, offset))
+                co_await ctx.wait(hash);
+        }
+        else
+        {
+            auto read_slot = co_await window.reads.acquire();
+            logger.debug("before queue_rw_pair read: offset: {}", offset);
+            auto read = [&]()
+            { src.prep_read(ctx.ring(), offset, block_size, &req); };
+            int bytes_read = std::min<int>(co_await retry_io(ctx, req, read, offset, block_size, opts, stats), block_size);
+            logger.debug("complete queue_rw_pair read: offset: {}", offset);
+            read_slot.release();
+
+            // Each destination writes the shared buffer with its own request; the
+            // group wakes us once, when the last of them completes. A partial tail
+            // sector is filled into the shared buffer per destination, so those
+            // writes go one at a time. The hash runs in the group too, so the
+            // buffer is only released once it and all writes are done, even if a
+            // write fails.
+            request group;
+            if (digest && digest->start(ctx.ring(), &hash, req.buf, bytes_read, offset))
+            {
+                hash.parent = &group;
+                group.pending++;
+            }
+            // All-zero blocks become hole punches or Write Zeroes where the destination supports it.
+            bool zero = opts.zero_detect && ZeroDetect::all_zero(req.buf, bytes_read);
+            if (zero)
+                stats.zero_blocks++;
+            std::vector<char> zeroed(dests.size());
+
+            auto write_slot = co_await window.writes.acquire();
+            std::vector<request> writes(dests.size());
+            bool serial = dests.size() > 1 && std::any_of(dests.begin(), dests.end(), [&](IOHandler *d)
+                                                          { return bytes_read % d->get_alignment() != 0; });
+            std::exception_ptr write_error;
+            for (size_t i = 0; i < dests.size() && !write_error; i++)
+            {
+                writes[i].buf = req.buf;
+                writes[i].buf_index = req.buf_index;
+                writes[i].lr = first_lr(opts);
+                try
+                {
+                    zeroed[i] = zero && dests[i]->zeroes_enabled() && dests[i]->prep_write_zeroes(ctx.ring(), offset, bytes_read, &writes[i]);
+                    if (!zeroed[i])
+                        dests[i]->prep_write(ctx.ring(), offset, bytes_read, &writes[i]);
+                    writes[i].parent = &group;
+                    group.pending++;
+                }
+                catch (const std::runtime_error &)
+                {
+                    write_error = std::current_exception();
+                }
+                if (serial)
+                    co_await ctx.wait_group(group);
+            }
+            co_await ctx.wait_group(group);
+
+            for (size_t i = 0; i < dests.size(); i++)
+            {
+                if (!writes[i].parent)
+                    continue;
+                // A destination that rejects the offload gets the zeros as data, now and from then on.
+                if (zeroed[i] && writes[i].res != 0)
+                {
+                    if (dests[i]->disable_zeroes())
+                        logger.warning("Writing zeroes to {} failed ({}), writing zero blocks as data", dests[i]->get_name(), writes[i].res);
+                    dests[i]->prep_write(ctx.ring(), offset, bytes_read, &writes[i]);
+                    group.pending++;
+                    co_await ctx.wait_group(group);
+                }
+                try
+                {
+                    // A retry completes on its own, outside the group.
+                    auto rewrite = [&]()
+                    {
+                        writes[i].parent = nullptr;
+                        dests[i]->prep_write(ctx.ring(), offset, bytes_read, &writes[i]);
+                    };
+                    co_await retry_io(ctx, writes[i], rewrite, offset, bytes_read, opts, stats, true);
+                    logger.debug("complete queue_rw_pair write: offset {} to {}", offset, dests[i]->get_name());
+                }
+                catch (const std::runtime_error &e)
+                {
+                    logger.error("Error at offset {} writing {}: {}", offset, dests[i]->get_name(), e.what());
+                }
+            }
+            if (write_error)
+                std::rethrow_exception(write_error);
+            written = bytes_read;
+        }
+
+        // Source data carries no headers, so the copy is checked by reading it
+        // back, from all destinations at once.
+        if (verify)
+        {
+            __u32 crc = Crc32c::compute(0, req.buf, written);
+            std::vector<Task<>> checks;
+            for (size_t i = 0; i < dests.size(); i++)
+                checks.push_back(verify_block(ctx, *dests[i], chk[i], offset, written, crc, window, stats));
+            co_await when_all(std::move(checks));
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        logger.error("Error at offset {}: {}", offset, e.what());
+    }
+    pool.release(&req);
+    for (auto &c : chk)
+        pool.release(&c);
+}
+
+Task<> issue_block(IoContext &ctx, BufferPool &pool, IOHandler &target, __u64 offset, __u32 len, bool write, block_verifier *verify, const copy_options &opts, copy_stats &stats)
+{
+    request req;
+    pool.acquire(&req);
+
+    try
+    {
+        std::vector<__u8> expect;
+        if (write && verify)
+            verify->stamp(req.buf, offset, len);
+        else if (verify)
+            expect = verify->expected(offset, len);
+        auto prep = [&]()
+        {
+            if (write)
+                target.prep_write(ctx.ring(), offset, len, &req);
+            else
+                target.prep_read(ctx.ring(), offset, len, &req);
+        };
+        co_await retry_io(ctx, req, prep, offset, len, opts, stats);
+
+        if (verify && write)
+            verify->written(req.buf, offset, len);
+        else if (verify)
+        {
+            stats.verified++;
+            std::string why = verify->check(req.buf, offset, len, expect);
+            if (!why.empty())
+            {
+                stats.verify_errors++;
+                logger.error("Verify failed for block at offset {}: {}", offset, why);
+            }
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        logger.error("Error {} at offset {}: {}", write ? "writing" : "reading", offset, e.what());
+    }
+    pool.release(&req);
+}
+
+Task<> run_admin_identify(IoContext &ctx, const std::string &dev_path)
+{
+    int fd = open(dev_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open device for admin cmd: " + dev_path);
+
+    auto buf = std::make_unique<char[]>(4096);
+    struct nvme_uring_cmd cmd = {};
+    cmd.opcode = nvme_admin_identify;
+    cmd.nsid = 0;
+    cmd.addr = (__u64)buf.get();
+    cmd.data_len = 4096;
+    cmd.cdw10 = NVME_IDENTIFY_CNS_CTRL;
+
+    logger.debug("Submitting Identify Controller command...");
+    int ret = co_await nvme_admin_passthru(ctx, fd, cmd);
+    close(fd);
+    if (ret != 0)
+    {
+        logger.error("Admin command failed: {}", ret < 0 ? std::string(strerror(-ret)) : NvmeStatus(ret).str());
+        co_return;
+    }
+    logger.debug("Admin command completed.");
+
+    std::string model_number(buf.get() + 4, 40);
+    model_number.erase(model_number.find_last_not_of(' ') + 1);
+    logger.debug(" > Model Number: {}", model_number);
+}
+
+// Chunk indices [head, tail) packed into one word, so the owner popping from
+// the front and thieves stealing from the back both need only a single CAS.
+struct alignas(64) chunk_deque
+{
+    std::atomic<__u64> range{0};
+    bool finished = false; /* the owner issues no more chunks */
+
+    static __u64 pack(__u32 head, __u32 tail) { return (static_cast<__u64>(tail) << 32) | head; }
+
+    void reset(__u32 head, __u32 tail) { range.store(pack(head, tail), std::memory_order_release); }
+
+    bool pop(__u32 &chunk)
+    {
+        __u64 cur = range.load(std::memory_order_acquire);
+        for (;;)
+        {
+            __u32 head = cur, tail = cur >> 32;
+            if (head >= tail)
+                return false;
+            if (range.compare_exchange_weak(cur, pack(head + 1, tail), std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                chunk = head;
+                return true;
+            }
+        }
+    }
+
+    // Takes the back half of the remaining chunks.
+    bool steal(__u32 &first, __u32 &last)
+    {
+        __u64 cur = range.load(std::memory_order_acquire);
+        for (;;)
+        {
+            __u32 head = cur, tail = cur >> 32;
+            if (head >= tail)
+                return false;
+            __u32 n = (tail - head + 1) / 2;
+            if (range.compare_exchange_weak(cur, pack(head, tail - n), std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                first = tail - n;
+                last = tail;
+                return true;
+            }
+        }
+    }
+};
+
+class chunk_scheduler
+{
+    std::unique_ptr<chunk_deque[]> deques;
+    int nworkers;
+    __u64 insize;
+    __u64 chunk_size;
+    __u64 nchunks;
+    std::vector<std::pair<__u64, __u64>> planned; /* chunk ranges of a sparse plan */
+    bool sparse;
+    std::atomic<bool> stopped{false};
+    std::atomic<int> issuing; /* workers not yet finished */
+
+public:
+    // With wrap, chunk indices run far past the range and map back onto it
+    // modulo nchunks, so the copy keeps cycling the range until stop().
+    // With extents, only those ranges are handed out, each split into chunks.
+    chunk_scheduler(__u64 insize, __u64 chunk_size, int nworkers, bool wrap = false, const std::vector<std::pair<__u64, __u64>> *extents = nullptr)
+        : deques(new chunk_deque[nworkers]), nworkers(nworkers), insize(insize), chunk_size(chunk_size), sparse(extents), issuing(nworkers)
+    {
+        if (extents)
+            for (auto [start, end] : *extents)
+                for (__u64 pos = start; pos < end; pos += chunk_size)
+                    planned.emplace_back(pos, std::min(end, pos + chunk_size));
+        nchunks = sparse ? planned.size() : (insize + chunk_size - 1) / chunk_size;
+        if (nchunks > UINT32_MAX)
+            throw std::runtime_error("Too many chunks, increase --chunk");
+        __u64 total = wrap && nchunks ? UINT32_MAX : nchunks;
+        for (int i = 0; i < nworkers; i++)
+            deques[i].reset(total * i / nworkers, total * (i + 1) / nworkers);
+    }
+
+    void stop() { stopped.store(true, std::memory_order_relaxed); }
+    bool is_stopped() const { return stopped.load(std::memory_order_relaxed); }
+
+    // Called by a worker that issues no more chunks, having run out or failed;
+    // calls after the first are ignored.
+    void finish(int worker)
+    {
+        if (!std::exchange(deques[worker].finished, true))
+            issuing.fetch_sub(1, std::memory_order_relaxed);
+    }
+    bool all_finished() const { return issuing.load(std::memory_order_relaxed) == 0; }
+
+    // Returns the next chunk for a worker, stealing from the others once its own deque is empty.
+    bool next(int worker, __u64 &start, __u64 &end, copy_stats &stats)
+    {
+        __u32 chunk, last;
+        if (is_stopped())
+            return false;
+        if (!deques[worker].pop(chunk))
+        {
+            int victim = 1;
+            for (; victim < nworkers; victim++)
+                if (deques[(worker + victim) % nworkers].steal(chunk, last))
+                    break;
+            if (victim == nworkers)
+                return false;
+            deques[worker].reset(chunk + 1, last);
+            stats.steals++;
+            logger.debug("Worker {} stole chunks [{}, {}) from worker {}", worker, chunk, last, (worker + victim) % nworkers);
+        }
+        if (sparse)
+            std::tie(start, end) = planned[chunk % nchunks];
+        else
+        {
+            start = (chunk % nchunks) * chunk_size;
+            end = std::min(insize, start + chunk_size);
+        }
+        return true;
+    }
+};
+
+// Periodic stats and the run deadline. Ticks come from a multishot
+// IORING_OP_TIMEOUT in ring 0, so no ring polls the clock to find the deadline.
+struct run_clock
+{
+    const std::vector<copy_stats> &stats;
+    chunk_scheduler &sched;
+    __u64 tick_ns;    /* timer period, 0 when neither --time nor --interval is set */
+    __u64 ticks_left; /* ticks until the deadline, 0 without --time */
+    bool print;       /* --interval was given */
+    __u64 start_ns = time_get_ns();
+    __u64 last_ns = start_ns;
+    __u64 last_ios = 0;
+    __u64 last_bytes = 0;
+
+    void tick()
+    {
+        __u64 now = time_get_ns(), ios = 0, bytes = 0;
+        for (auto &st : stats)
+        {
+            ios += st.iocount.load(std::memory_order_relaxed);
+            bytes += st.progress.load(std::memory_order_relaxed);
+        }
+        if (print)
+        {
+            double us = (now - last_ns) / 1000.0;
+            printf("  [%7.1fs] %.2f MB/s, %.0f IOPS\n", (now - start_ns) / 1e9, (bytes - last_bytes) / us, (ios - last_ios) * 1e6 / us);
+            fflush(stdout);
+        }
+        last_ns = now;
+        last_ios = ios;
+        last_bytes = bytes;
+        if (ticks_left && --ticks_left == 0)
+        {
+            logger.debug("Run time reached, stopping.");
+            sched.stop();
+        }
+    }
+};
+
+struct ticker_state
+{
+    request req;
+    struct __kernel_timespec ts;
+    bool done = false;
+    bool failed = false;
+    bool removing = false;
+};
+
+Task<> stats_ticker(IoContext &ctx, run_clock &clock, ticker_state &t)
+{
+    t.ts.tv_sec = clock.tick_ns / 1000000000;
+    t.ts.tv_nsec = clock.tick_ns % 1000000000;
+    t.req.rw_dir = 'T';
+    io_uring_sqe *sqe = ctx.get_sqe();
+    io_uring_prep_timeout(sqe, &t.ts, 0, IORING_TIMEOUT_MULTISHOT);
+    io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(&t.req));
+
+    for (bool first = true;; first = false)
+    {
+        int res = co_await ctx.wait(t.req);
+        if (res != -ETIME)
+        {
+            // Multishot timeouts need Linux 6.4; older kernels reject them with -EINVAL.
+            if (first && res != -ECANCELED)
+            {
+                logger.warning("Multishot timeout unavailable ({}), ticking from the clock", strerror(-res));
+                t.failed = true;
+            }
+            break;
+        }
+        clock.tick();
+        if (!(t.req.flags & IORING_CQE_F_MORE))
+            break;
+    }
+    t.done = true;
+}
+
+// Worker 0 owns the ticks. IOPOLL rings do not take timeouts, so there (and on
+// kernels without multishot timeouts) it checks the clock after each reap instead.
+void start_ticker(IoContext &ctx, run_clock *clock, const copy_options &opts, ticker_state &t)
+{
+    if (clock && !opts.iopoll)
+        ctx.spawn(stats_ticker(ctx, *clock, t));
+    else
+        t.done = true;
+}
+
+void poll_clock(run_clock *clock, const copy_options &opts, const ticker_state &t, __u64 &next_tick)
+{
+    if (!clock || !(opts.iopoll || t.failed))
+        return;
+    __u64 now = time_get_ns();
+    if (!next_tick)
+        next_tick = clock->start_ns + clock->tick_ns;
+    for (; now >= next_tick; next_tick += clock->tick_ns)
+        clock->tick();
+}
+
+// Ends the ticker once no ring has blocks left to issue, so the interval
+// output lasts as long as any ring copies; ring 0 keeps running until the
+// ticker has seen the removal.
+void stop_ticker(IoContext &ctx, const chunk_scheduler &sched, ticker_state &t)
+{
+    if (t.done || t.removing || !sched.all_finished())
+        return;
+    t.removing = true;
+    io_uring_sqe *sqe = ctx.get_sqe();
+    io_uring_prep_timeout_remove(sqe, reinterpret_cast<__u64>(static_cast<IoCompletion *>(&t.req)), 0);
+    io_uring_sqe_set_data(sqe, nullptr);
+}
+
+// AIMD controller for the number of inflight blocks of one ring. The limit
+// grows by one per window while throughput keeps up, and is halved when
+// block latency jumps well above the best seen without a throughput gain
+// (e.g. device GC). Each window spans max(limit, 8) completed blocks.
+class depth_controller
+{
+    int id;
+    int min_qd;
+    int max_qd;
+    int qd;
+    bool enabled;
+    __u64 window_start = 0;
+    __u64 window_bytes = 0;
+    __u64 window_lat = 0;
+    int window_ios = 0;
+    double best_lat = 0;
+    double last_bw = 0;
+
+public:
+    depth_controller(int id, int min_qd, int max_qd, bool enabled)
+        : id(id), min_qd(std::clamp(min_qd, 1, max_qd)), max_qd(max_qd), qd(enabled ? this->min_qd : max_qd), enabled(enabled) {}
+
+    int limit() const { return qd; }
+
+    void complete(__u64 lat_ns, __u64 bytes)
+    {
+        if (!enabled)
+            return;
+        __u64 now = time_get_ns();
+        if (window_ios == 0)
+            window_start = now - lat_ns;
+        window_lat += lat_ns;
+        window_bytes += bytes;
+        if (++window_ios < std::max(qd, 8))
+            return;
+
+        double lat = static_cast<double>(window_lat) / window_ios;
+        double bw = static_cast<double>(window_bytes) * 1000 / (now - window_start);
+        // Let the baseline drift up slowly so one lucky window does not pin it.
+        best_lat = (best_lat == 0 || lat < best_lat) ? lat : best_lat * 1.01;
+
+        int next = qd;
+        if (lat > 2 * best_lat && bw < last_bw * 1.05)
+            next = std::max(min_qd, qd / 2);
+        else if (bw >= last_bw * 0.98)
+            next = std::min(max_qd, qd + 1);
+        if (next != qd)
+            logger.info("ring {}: queue depth {} -> {} (lat {:.1f} us, {:.2f} MB/s)", id, qd, next, lat / 1000, bw);
+
+        qd = next;
+        last_bw = bw;
+        window_bytes = window_lat = 0;
+        window_ios = 0;
+    }
+};
+
+// Feeds the AIMD controller with the latency of one block once it is done.
+Task<> timed_block(Task<> block, depth_controller &depth, __u32 len)
+{
+    __u64 issued = time_get_ns();
+    co_await block;
+    depth.complete(time_get_ns() - issued, len);
+}
+
+struct io_uring_params ring_params(const copy_options &opts)
+{
+    struct io_uring_params params = {};
+
+    params.flags = IORING_SETUP_SQE128 | IORING_SETUP_CQE32;
+    if (opts.iopoll)
+        params.flags |= IORING_SETUP_IOPOLL;
+    if (opts.sqpoll)
+    {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = opts.sq_idle;
+        if (opts.sq_cpu >= 0)
+        {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = opts.sq_cpu;
+        }
+        if (opts.sq_wq_fd >= 0)
+        {
+            params.flags |= IORING_SETUP_ATTACH_WQ;
+            params.wq_fd = opts.sq_wq_fd;
+        }
+    }
+    logger.debug("ring setup flags {}", params.flags);
+    return params;
+}
+
+// Completion hook of a copy ring, where every completion is a request. Counts
+// I/O cancelled by its deadline or by a cancel and failed passthrough commands,
+// records the latency of reads and writes, and hands the status of a failed
+// part of a split passthrough I/O to the I/O, which completes when its last
+// part does.
+auto request_completed(copy_stats &stats)
+{
+    return [&stats](IoCompletion *c, __u64 now)
+    {
+        auto *req = static_cast<request *>(c);
+        if (req->parts.empty())
+        {
+            if (req->res == -ECANCELED)
+            {
+                if (cancel_requested.load(std::memory_order_relaxed))
+                    stats.cancelled++;
+                // In a chain, a failed SQE ahead cancels it the same way as its deadline.
+                else if (req->deadline && !req->chained)
+                    stats.timeouts++;
+            }
+            if (req->passthru && req->res > 0)
+                nvme_errors.record(NvmeStatus(req->res));
+        }
+        // A split I/O is timed as a whole, from its first part's submission to its last completion.
+        auto *parent = static_cast<request *>(req->parent);
+        bool part = parent && !parent->parts.empty();
+        if (req->rw_dir == 'R' && !part)
+            stats.read_lat.record(now - req->submit_ns);
+        else if (req->rw_dir == 'W' && !part)
+            stats.write_lat.record(now - req->submit_ns);
+        if (part && req->res != 0 && parent->res == 0)
+        {
+            parent->res = req->res;
+            parent->flags = req->flags;
+            memcpy(parent->big_cqe, req->big_cqe, sizeof(req->big_cqe));
+        }
+    };
+}
+
+// Once per ring after a cancel request: stops handing out chunks and cancels
+// everything in flight, so the blocks complete with -ECANCELED and drain.
+void poll_cancel(IoContext &ctx, chunk_scheduler &sched, bool &cancelling)
+{
+    if (cancelling || !cancel_requested.load(std::memory_order_relaxed))
+        return;
+    cancelling = true;
+    sched.stop();
+    io_uring_sqe *sqe = ctx.get_sqe();
+    io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data(sqe, nullptr);
+}
+
+// Bound on each wait of a ring's loop, so a ring whose I/O all hangs still
+// gets back to it to notice a cancel.
+constexpr __u64 POLL_NS = 100000000;
+
+void copy_worker(IOHandler &src, const std::vector<IOHandler *> &dests, chunk_scheduler &sched, int id, int bs, __u32 buf_align, const copy_options &opts, digest_stage *digest, copy_stats &stats, run_clock *clock)
+{
+    // Blocks in flight per ring; the windows only gate their reads and writes.
+    int qd = opts.buffers;
+    copy_window window{ring_semaphore(opts.read_qd), ring_semaphore(opts.write_qd)};
+
+    // A linked block holds two SQEs until it is submitted, a fan-out block one
+    // per destination, and a hashed block has its hash message completing next to
+    // its writes. A deadline adds a linked timeout SQE to each I/O.
+    struct io_uring_params params = ring_params(opts);
+    IoContext ctx(qd * std::max<int>(opts.link || digest ? 2 : 1, dests.size()) * (opts.io_timeout_ns ? 2 : 1), params);
+    BufferPool pool(ctx.ring(), qd * (1 + (opts.verify ? dests.size() : 0)), bs, std::max<size_t>(buf_align, 4096));
+    std::vector<IOHandler *> handlers{&src};
+    handlers.insert(handlers.end(), dests.begin(), dests.end());
+    register_handler_files(ctx.ring(), handlers, opts.files);
+    ctx.on_complete(request_completed(stats));
+
+    depth_controller depth(id, opts.min_qd, qd, opts.adaptive);
+    ticker_state ticker;
+    start_ticker(ctx, clock, opts, ticker);
+
+    // Runs as a task of ctx, whose run() returns only once it has finished.
+    auto issue = [&]() -> Task<>
+    {
+        Nursery blocks;
+        __u64 offset = 0, end = 0;
+        for (;;)
+        {
+            co_await blocks.wait_below(depth.limit());
+            if ((offset >= end || sched.is_stopped()) && !sched.next(id, offset, end, stats))
+                break;
+            __u64 this_size = (end - offset < static_cast<__u64>(bs)) ? (end - offset) : bs;
+            auto block = read_and_write_block(ctx, pool, src, dests, offset, this_size, opts, window, digest, stats);
+            blocks.start(opts.adaptive ? timed_block(std::move(block), depth, this_size) : std::move(block));
+
+            logger.debug("read_and_write_block called with offset: {}, size: {}, inflight: {}", offset, this_size, blocks.size());
+            offset += this_size;
+            stats.progress += this_size;
+            stats.iocount++;
+        }
+        sched.finish(id);
+        stop_ticker(ctx, sched, ticker);
+        co_await blocks.join();
+    };
+    ctx.spawn(issue());
+
+    bool cancelling = false;
+    __u64 next_tick = 0;
+    auto poll = [&]()
+    {
+        poll_clock(clock, opts, ticker, next_tick);
+        poll_cancel(ctx, sched, cancelling);
+        stop_ticker(ctx, sched, ticker);
+    };
+    ctx.run(poll, POLL_NS);
+}
+
+// Picks block sizes, directions and offsets for one workload ring. Seeds are
+// fixed per ring, so a random run repeats its offsets like fio's randrepeat.
+class workload_generator
+{
+    const workload_spec &spec;
+    std::mt19937_64 rng;
+    __u64 insize;
+    __u64 nblocks;
+    __u32 granule;
+    std::discrete_distribution<size_t> pick_bs;
+    std::optional<ZipfDistribution> zipf;
+
+    // Scatters zipf ranks over the range so the hot blocks are not all at its start.
+    static __u64 scatter(__u64 x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+public:
+    workload_generator(const workload_spec &spec, __u64 insize, __u64 seed) : spec(spec), rng(seed), insize(insize)
+    {
+        std::vector<double> weights;
+        granule = UINT32_MAX;
+        for (auto &[bs, weight] : spec.bssplit)
+        {
+            weights.push_back(weight);
+            granule = std::min(granule, bs);
+        }
+        pick_bs = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+        nblocks = std::max<__u64>(1, insize / granule);
+        if (spec.zipf_theta > 0)
+            zipf.emplace(nblocks, spec.zipf_theta);
+    }
+
+    __u32 block_size() { return spec.bssplit[pick_bs(rng)].first; }
+    bool is_write() { return static_cast<int>(rng() % 100) >= spec.read_pct; }
+
+    // A random offset on a granule boundary, with the whole block inside the range.
+    __u64 offset(__u32 len)
+    {
+        __u64 idx = zipf ? scatter((*zipf)(rng) - 1) % nblocks : std::uniform_int_distribution<__u64>(0, nblocks - 1)(rng);
+        __u64 last = insize > len ? (insize - len) / granule : 0;
+        return std::min(idx, last) * granule;
+    }
+};
+
+// Chunks from the scheduler are the byte budget of a workload ring; sequential
+// runs also take their offsets from them, random runs draw their own.
+void workload_worker(IOHandler &target, chunk_scheduler &sched, int id, __u64 insize, __u32 buf_align, const copy_options &opts, block_verifier *verify, copy_stats &stats, run_clock *clock)
+{
+    const workload_spec &wl = opts.workload;
+    int qd = opts.qd;
+
+    struct io_uring_params params = ring_params(opts);
+    IoContext ctx(qd * (opts.io_timeout_ns ? 2 : 1), params);
+    __u32 max_bs = 0;
+    for (auto &entry : wl.bssplit)
+        max_bs = std::max(max_bs, entry.first);
+    BufferPool pool(ctx.ring(), qd, max_bs, std::max<size_t>(buf_align, 4096));
+    register_handler_files(ctx.ring(), {&target}, opts.files);
+    ctx.on_complete(request_completed(stats));
+
+    depth_controller depth(id, opts.min_qd, qd, opts.adaptive);
+    workload_generator gen(wl, insize, id + 1);
+    ticker_state ticker;
+    start_ticker(ctx, clock, opts, ticker);
+
+    // Runs as a task of ctx, whose run() returns only once it has finished.
+    auto issue = [&]() -> Task<>
+    {
+        Nursery blocks;
+        __u64 offset = 0, end = 0;
+        for (;;)
+        {
+            co_await blocks.wait_below(depth.limit());
+            if ((offset >= end || sched.is_stopped()) && !sched.next(id, offset, end, stats))
+                break;
+            __u32 len = std::min<__u64>(gen.block_size(), end - offset);
+            bool write = gen.is_write();
+            __u64 at = wl.random ? gen.offset(len) : offset;
+            auto block = issue_block(ctx, pool, target, at, len, write, verify, opts, stats);
+            blocks.start(opts.adaptive ? timed_block(std::move(block), depth, len) : std::move(block));
+
+            logger.debug("issue_block called with offset: {}, size: {}, {}", at, len, write ? "write" : "read");
+            offset += len;
+            stats.progress += len;
+            stats.iocount++;
+        }
+        sched.finish(id);
+        stop_ticker(ctx, sched, ticker);
+        co_await blocks.join();
+    };
+    ctx.spawn(issue());
+
+    bool cancelling = false;
+    __u64 next_tick = 0;
+    auto poll = [&]()
+    {
+        poll_clock(clock, opts, ticker, next_tick);
+        poll_cancel(ctx, sched, cancelling);
+        stop_ticker(ctx, sched, ticker);
+    };
+    ctx.run(poll, POLL_NS);
+}
+
+void print_latency(const char *name, const LatencyHistogram &h)
+{
+    if (!h.count())
+        return;
+    printf("  %s lat (us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n", name, h.percentile(50) / 1000.0,
+           h.percentile(90) / 1000.0, h.percentile(99) / 1000.0, h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+}
+
+void print_nvme_errors()
+{
+    if (!nvme_errors.total())
+        return;
+    printf("  NVMe errors:\n");
+    nvme_errors.for_each([](NvmeStatus s, uint64_t n)
+                         { printf("    %8llu  %#06x %s\n", (unsigned long long)n, s.value, s.str().c_str()); });
+}
+
+void write_json_report(const std::string &path, const copy_stats &total, __u64 time_ns)
+{
+    std::ofstream js(path);
+    if (!js)
+        throw std::runtime_error("Failed to open JSON report: " + path);
+    js << "{\"ios\": " << total.iocount << ", \"bytes\": " << total.progress << ", \"seconds\": " << time_ns / 1e9
+       << ", \"verified\": " << total.verified << ", \"verify_errors\": " << total.verify_errors << ", \"timeouts\": " << total.timeouts
+       << ", \"cancelled\": " << total.cancelled << ", \"retried\": " << total.retried << ", \"recovered\": " << total.recovered
+       << ", \"failed\": " << total.bad.size() << ", \"nvme_errors\": {";
+    const char *sep = "";
+    auto status = [&](NvmeStatus s, uint64_t n)
+    {
+        js << sep << "\"" << std::format("{:#x}", s.value) << "\": " << n;
+        sep = ", ";
+    };
+    nvme_errors.for_each(status);
+    js << "}, \"read_lat_ns\": ";
+    total.read_lat.to_json(js);
+    js << ", \"write_lat_ns\": ";
+    total.write_lat.to_json(js);
+    js << "}\n";
+}
+
+// Writes the failed I/Os, sorted and with overlapping or adjacent ones
+// merged, as "offset length" lines. Returns the number of ranges.
+size_t write_bad_ranges(const std::string &path, std::vector<std::pair<__u64, __u32>> bad)
+{
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Failed to open bad range file: " + path);
+    std::sort(bad.begin(), bad.end());
+    std::vector<std::pair<__u64, __u64>> ranges;
+    for (auto [offset, len] : bad)
+    {
+        if (!ranges.empty() && offset <= ranges.back().second)
+            ranges.back().second = std::max(ranges.back().second, offset + len);
+        else
+            ranges.emplace_back(offset, offset + len);
+    }
+    out << "# offset length (bytes) of ranges that failed every attempt\n";
+    for (auto [start, end] : ranges)
+        out << std::format("{} {}\n", start, end - start);
+    return ranges.size();
+}
+
+void pin_thread(std::thread &t, int cpu)
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    int ret = pthread_setaffinity_np(t.native_handle(), sizeof(cpuset), &cpuset);
+    if (ret != 0)
+        logger.warning("Failed to pin copy thread to CPU {}: {}", cpu, strerror(ret));
+}
+
+// Plans a sparse copy from the source's data extents, rounded out to whole
+// blocks. The holes in between are punched on (or left unallocated in) every
+// destination; if one cannot punch, the whole range is copied instead.
+bool plan_sparse_copy(IOHandler &src, const std::vector<IOHandler *> &dests, __u64 insize, __u32 bs, std::vector<std::pair<__u64, __u64>> &extents)
+{
+    std::vector<std::pair<__u64, __u64>> raw;
+    if (!src.data_extents(insize, raw))
+        return false;
+    __u64 data = 0;
+    for (auto [start, end] : raw)
+    {
+        start = start / bs * bs;
+        end = std::min(insize, (end + bs - 1) / bs * bs);
+        if (!extents.empty() && extents.back().second >= start)
+            extents.back().second = std::max(extents.back().second, end);
+        else
+            extents.emplace_back(start, end);
+    }
+    for (auto [start, end] : extents)
+        data += end - start;
+    if (data == insize)
+        return false;
+
+    for (auto *d : dests)
+    {
+        d->set_size(insize);
+        for (size_t i = 0, pos = 0; i <= extents.size(); i++)
+        {
+            __u64 hole_end = i < extents.size() ? extents[i].first : insize;
+            int ret = hole_end > pos ? d->punch_hole(pos, hole_end - pos) : 0;
+            if (ret < 0)
+            {
+                logger.warning("Cannot punch holes in {} ({}), copying holes as data", d->get_name(), strerror(-ret));
+                extents.clear();
+                return false;
+            }
+            if (i < extents.size())
+                pos = extents[i].second;
+        }
+    }
+    logger.info("Sparse copy: {} of {} bytes in {} data extents", data, insize, extents.size());
+    return true;
+}
+
+void run_copy_logic(IOHandler &src, const std::vector<IOHandler *> &dests, __u64 insize, copy_options opts)
+{
+    int bs = opts.bs;
+    std::vector<IOHandler *> handlers{&src};
+    handlers.insert(handlers.end(), dests.begin(), dests.end());
+    // Blocks are a multiple of every handler's I/O granule, which need not be a
+    // power of two on an extended-LBA namespace; buffers take the largest power
+    // of two among them as their memory alignment.
+    __u32 align = 1, buf_align = 1;
+    for (auto *h : handlers)
+    {
+        __u32 granule = h->get_alignment();
+        align = std::lcm(align, granule);
+        buf_align = std::max(buf_align, granule & -granule);
+        h->set_io_timeout(opts.io_timeout_ns);
+    }
+    if (bs % align)
+    {
+        bs = (bs + align - 1) / align * align;
+        logger.warning("Block size rounded up to {} bytes for {}-byte alignment", bs, align);
+    }
+
+    // Workload blocks of every size stay on multiples of step, which is also the verify unit.
+    workload_spec &wl = opts.workload;
+    __u32 step = bs;
+    std::unique_ptr<block_verifier> verifier;
+    if (wl.enabled)
+    {
+        if (wl.bssplit.empty())
+            wl.bssplit.emplace_back(bs, 100);
+        step = 0;
+        for (auto &entry : wl.bssplit)
+        {
+            entry.first = (entry.first + align - 1) / align * align;
+            step = std::gcd(step, entry.first);
+        }
+        if (opts.verify)
+        {
+            if (step < 512)
+                throw std::runtime_error("--verify needs workload block sizes in multiples of 512 bytes");
+            __u32 seed = std::random_device{}();
+            verifier = std::make_unique<block_verifier>(insize, step, seed, wl.read_pct > 0 && wl.read_pct < 100);
+            logger.info("Verifying {}-byte units, seed {:#x}", step, seed);
+        }
+        logger.info("Running {}% reads {} workload over {} bytes of {}", wl.read_pct, wl.random ? (wl.zipf_theta > 0 ? "zipf" : "random") : "sequential", insize, src.get_name());
+    }
+    else if (!dests.empty())
+    {
+        std::string names = dests[0]->get_name();
+        for (size_t i = 1; i < dests.size(); i++)
+            names += ", " + dests[i]->get_name();
+        logger.info("Copying {} bytes from {} to {}", insize, src.get_name(), names);
+        if (opts.link && dests.size() > 1)
+            logger.warning("--link is ignored when copying to several destinations");
+        else if (opts.link && !src.errors_break_links())
+            logger.warning("--link is ignored for {}: a failed passthrough read would not stop its linked write", src.get_name());
+        else if (opts.link && opts.zero_detect)
+            logger.warning("--link is ignored with --zero-detect, which must see a block before writing it");
+    }
+    else
+        logger.info("Copying {} bytes from {}", insize, src.get_name());
+    if (!wl.enabled && (opts.read_qd != opts.qd || opts.write_qd != opts.qd || opts.buffers != opts.qd))
+        logger.info("Read window {}, write window {}, {} buffers per ring", opts.read_qd, opts.write_qd, opts.buffers);
+    assign_fixed_slots(handlers, opts.files);
+
+    // Polled rings only complete O_DIRECT and passthrough I/O; anything else
+    // fails with EOPNOTSUPP, and so do timeouts.
+    if (opts.iopoll)
+    {
+        for (auto *h : handlers)
+            if (!h->supports_iopoll())
+                throw std::runtime_error("IOPOLL needs a block device or NVMe namespace passthrough: " + h->get_name());
+        if (opts.files == FIXED_FILES_DIRECT)
+            throw std::runtime_error("IOPOLL rings cannot open direct descriptors, use --fixed-files register");
+        if (opts.io_timeout_ns)
+            throw std::runtime_error("IOPOLL rings cannot take the linked timeouts of --io-timeout");
+        if (opts.retries && opts.retry_backoff_ns)
+            throw std::runtime_error("IOPOLL rings cannot take the retry backoff timeout, use --retry-backoff 0");
+    }
+
+    // Copy rings attached to one idle anchor ring share its pinned SQ poll thread
+    // instead of each burning a core on its own poller.
+    std::optional<IoContext> sq_anchor;
+    if (opts.sqpoll && opts.sq_shared)
+    {
+        struct io_uring_params params = ring_params(opts);
+        sq_anchor.emplace(1, params);
+        opts.sq_wq_fd = sq_anchor->ring()->ring_fd;
+    }
+
+    // Each thread owns one ring and starts on a contiguous run of chunks; idle threads steal the rest.
+    int nthreads = std::max(1, opts.threads);
+    __u64 chunk = std::max<__u64>(opts.chunk, step) / step * step;
+    std::vector<std::pair<__u64, __u64>> extents;
+    bool sparse = opts.sparse && !wl.enabled && plan_sparse_copy(src, dests, insize, bs, extents);
+    // Punched zero blocks at the end of a file destination must not leave it short.
+    if (opts.zero_detect && !sparse)
+        for (auto *d : dests)
+            d->set_size(insize);
+    chunk_scheduler sched(insize, chunk, nthreads, opts.run_ns > 0, sparse ? &extents : nullptr);
+    std::unique_ptr<digest_stage> digest;
+    if (!opts.digest.empty())
+    {
+        if (wl.enabled || opts.run_ns)
+            throw std::runtime_error("--digest needs a single copy pass, without --rw or --time");
+        digest = std::make_unique<digest_stage>(insize, bs, opts.hash_threads);
+    }
+    std::vector<copy_stats> stats(nthreads);
+    __u64 tick_ns = opts.interval_ns ? opts.interval_ns : opts.run_ns;
+    run_clock clock{stats, sched, tick_ns, opts.run_ns ? (opts.run_ns + tick_ns - 1) / tick_ns : 0, opts.interval_ns > 0};
+    run_clock *ring0_clock = tick_ns ? &clock : nullptr;
+    if (opts.run_ns)
+        logger.info("Running for {:.1f} seconds, wrapping around the range", opts.run_ns / 1e9);
+    // A failed worker counts as finished, or ring 0 would tick on for it.
+    auto worker = [&](int i, run_clock *clock)
+    {
+        try
+        {
+            if (wl.enabled)
+                workload_worker(src, sched, i, insize, buf_align, opts, verifier.get(), stats[i], clock);
+            else
+                copy_worker(src, dests, sched, i, bs, buf_align, opts, digest.get(), stats[i], clock);
+        }
+        catch (...)
+        {
+            sched.finish(i);
+            throw;
+        }
+    };
+    __u64 time_tag = time_get_ns();
+
+    if (nthreads == 1)
+        worker(0, ring0_clock);
+    else
+    {
+        int ncpus = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nthreads; i++)
+        {
+            threads.emplace_back([&, i]()
+                                 {
+                try
+                {
+                    worker(i, i == 0 ? ring0_clock : nullptr);
+                }
+                catch (const std::exception &e)
+                {
+                    logger.error("Copy thread {} failed: {}", i, e.what());
+                } });
+            pin_thread(threads.back(), i % ncpus);
+            logger.debug("Copy thread {} on CPU {}", i, i % ncpus);
+        }
+        for (auto &t : threads)
+            t.join();
+    }
+
+    copy_stats total;
+    for (auto &st : stats)
+    {
+        total.iocount += st.iocount;
+        total.progress += st.progress;
+        total.steals += st.steals;
+        total.verified += st.verified;
+        total.verify_errors += st.verify_errors;
+        total.zero_blocks += st.zero_blocks;
+        total.timeouts += st.timeouts;
+        total.cancelled += st.cancelled;
+        total.retried += st.retried;
+        total.recovered += st.recovered;
+        total.bad.insert(total.bad.end(), st.bad.begin(), st.bad.end());
+        total.read_lat.merge(st.read_lat);
+        total.write_lat.merge(st.write_lat);
     }
     time_tag = time_get_ns() - time_tag;
-    printf("  It took %d IOs, %lld sectors, %.3f seconds. %.2f MB/s\n", iocount, progress, (float)time_tag / 1000000000, (progress * 512) / ((float)time_tag / 1000));
-    logger.debug("Copy finished.");
-    io_uring_queue_exit(&ring);
+    printf("  It took %lld IOs, %lld bytes, %.3f seconds. %.2f MB/s\n", total.iocount.load(), total.progress.load(), (float)time_tag / 1000000000, total.progress / ((float)time_tag / 1000));
+    print_latency("read ", total.read_lat);
+    print_latency("write", total.write_lat);
+    if (opts.verify)
+        printf("  Verified %llu blocks, %llu failed\n", total.verified, total.verify_errors);
+    if (opts.zero_detect)
+        printf("  %llu zero blocks written without data\n", total.zero_blocks);
+    if (opts.io_timeout_ns || total.cancelled)
+        printf("  %llu I/Os timed out, %llu cancelled\n", total.timeouts, total.cancelled);
+    if (opts.retries || !total.bad.empty())
+        printf("  %llu retries, %llu I/Os recovered, %zu failed\n", total.retried, total.recovered, total.bad.size());
+    if (!opts.bad_ranges.empty())
+        printf("  %zu bad ranges written to %s\n", write_bad_ranges(opts.bad_ranges, total.bad), opts.bad_ranges.c_str());
+    print_nvme_errors();
+    if (digest)
+        printf("  Digest %08x written to %s\n", digest->write(opts.digest, insize, chunk), opts.digest.c_str());
+    if (!opts.json.empty())
+        write_json_report(opts.json, total, time_tag);
+    logger.debug("Copy finished, {} chunk steals.", total.steals);
+    if (total.verify_errors)
+        throw std::runtime_error(std::format("{} blocks failed verification", total.verify_errors));
+    if (cancel_requested)
+        throw std::runtime_error("Cancelled");
 }
 
-std::unique_ptr<IOHandler> create_handler(const std::string &path, bool is_source)
+// access is O_RDONLY for a copy source, O_WRONLY for a copy destination and O_RDWR for a workload target.
+std::unique_ptr<IOHandler> create_handler(const std::string &path, int access)
 {
-    int flags = is_source ? O_RDONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+    bool is_source = access == O_RDONLY;
+    int flags = access == O_WRONLY ? (O_WRONLY | O_CREAT | O_TRUNC) : access;
     int fd = open(path.c_str(), flags, 0644);
     if (fd < 0)
     {
@@ -452,7 +2556,13 @@ std::unique_ptr<IOHandler> create_handler(const std::string &path, bool is_sourc
     }
     else if (S_ISBLK(st.st_mode))
     {
-        return NULL;
+        // Block devices bypass the page cache; O_CREAT/O_TRUNC mean nothing here.
+        // Writers need read access too for the read-modify-write of a partial tail sector.
+        close(fd);
+        fd = open(path.c_str(), (is_source ? O_RDONLY : O_RDWR) | O_DIRECT);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open block device with O_DIRECT: " + path);
+        return std::make_unique<BlockIOHandler>(path, fd);
     }
     else if (S_ISCHR(st.st_mode))
     {
@@ -465,6 +2575,67 @@ std::unique_ptr<IOHandler> create_handler(const std::string &path, bool is_sourc
     }
 }
 
+// Byte count with an optional k, m or g suffix.
+__u64 parse_size(const std::string &str)
+{
+    size_t pos;
+    __u64 value = std::stoull(str, &pos);
+    switch (pos < str.size() ? tolower(str[pos]) : 0)
+    {
+    case 'g':
+        value <<= 10;
+        [[fallthrough]];
+    case 'm':
+        value <<= 10;
+        [[fallthrough]];
+    case 'k':
+        value <<= 10;
+        [[fallthrough]];
+    case 0:
+        return value;
+    default:
+        throw std::runtime_error("Invalid size: " + str);
+    }
+}
+
+workload_spec parse_workload(const std::string &rw, int mix, const std::string &dist, const std::string &bssplit)
+{
+    workload_spec wl;
+    if (rw.empty())
+        return wl;
+    wl.enabled = true;
+    wl.random = rw.rfind("rand", 0) == 0;
+    std::string op = wl.random ? rw.substr(4) : rw;
+    if (op == "read")
+        wl.read_pct = 100;
+    else if (op == "write")
+        wl.read_pct = 0;
+    else if (op == "rw")
+        wl.read_pct = std::clamp(mix, 0, 100);
+    else
+        throw std::runtime_error("Invalid --rw: " + rw);
+
+    if (dist.rfind("zipf:", 0) == 0)
+        wl.zipf_theta = std::stod(dist.substr(5));
+    else if (dist != "uniform")
+        throw std::runtime_error("Invalid --random-distribution: " + dist);
+    if (wl.zipf_theta < 0)
+        throw std::runtime_error("Zipf theta must be positive: " + dist);
+
+    // fio syntax: size/weight entries separated by ':'
+    for (size_t pos = 0; pos < bssplit.size();)
+    {
+        size_t next = bssplit.find(':', pos);
+        std::string entry = bssplit.substr(pos, next - pos);
+        size_t slash = entry.find('/');
+        if (slash == std::string::npos)
+            throw std::runtime_error("Invalid --bssplit entry: " + entry);
+        wl.bssplit.emplace_back(parse_size(entry.substr(0, slash)), std::stoul(entry.substr(slash + 1)));
+        pos = next == std::string::npos ? bssplit.size() : next + 1;
+    }
+    return wl;
+}
+
 void print_usage(const char *prog_name)
 {
     logger.info("Usage: ");
@@ -482,11 +2653,40 @@ int main(int argc, char *argv[])
     parser.add_option("--lr", "-l", "Limited Retry (LR): 1-limited retry efforts, 0-apply all available error recovery", false, "0");
     parser.add_option("--slba", "-s", "64-bit address of the first logical block", true);
     parser.add_option("--nlb", "-n", "The number of LBAs to return", false);
-    parser.add_option("--filename", "-f", "File name to save raw binary", false);
+    parser.add_option("--filename", "-f", "File name to save raw binary, or a comma-separated list to copy to all of them", false);
     parser.add_option("--bs", "-c", "block size", false, "512");
     parser.add_option("--depth", "-d", "io depth", false, "64");
-    parser.add_option("--time", "-t", "test time (unit: min)", false, "2");
+    parser.add_option("--read-depth", "", "reads in flight per ring, independent of the writes (default: --depth)", false);
+    parser.add_option("--write-depth", "", "blocks being written per ring (default: --depth)", false);
+    parser.add_option("--buffers", "", "blocks per ring; those beyond the write depth queue up read ahead (default: read + write depth)", false);
+    parser.add_flag("--adaptive", "", "adapt the inflight blocks between --min-depth and --depth at runtime");
+    parser.add_option("--min-depth", "", "lowest io depth for --adaptive", false, "1");
+    parser.add_option("--time", "-t", "test time, wrapping around the range until it expires (unit: min, 0: copy once)", false, "0");
+    parser.add_option("--interval", "-I", "print throughput and IOPS every interval (unit: sec, 0: off)", false, "0");
+    parser.add_option("--rw", "", "run a workload on the source instead of copying: read, write, rw, randread, randwrite, randrw", false);
+    parser.add_option("--rwmixread", "", "percentage of reads for rw and randrw", false, "50");
+    parser.add_option("--random-distribution", "", "offsets of random workloads: uniform or zipf:<theta>", false, "uniform");
+    parser.add_option("--bssplit", "", "workload block size distribution, e.g. 4k/70:64k/30 (default: --bs)", false);
+    parser.add_flag("--no-sparse", "", "copy holes of a sparse source file as data instead of skipping them");
+    parser.add_flag("--zero-detect", "", "write all-zero blocks as hole punches or Write Zeroes instead of data");
+    parser.add_flag("--verify", "", "check data: copies read each block back, workloads stamp verify headers on writes and check them on reads");
+    parser.add_option("--digest", "-D", "hash copied blocks while they are written and save a per-chunk crc32c digest to this file", false);
+    parser.add_option("--hash-threads", "", "threads hashing for --digest, 0 hashes on the copy threads", false, "2");
+    parser.add_option("--io-timeout", "", "cancel an I/O that has not completed after this long (unit: ms, 0: off)", false, "0");
+    parser.add_option("--retries", "", "retries of a failed read or write; the first attempt then sets Limited Retry and retries clear it", false, "0");
+    parser.add_option("--retry-backoff", "", "wait before the first retry, doubled per retry (unit: ms)", false, "10");
+    parser.add_option("--bad-ranges", "", "write the ranges that failed every attempt to this file", false);
+    parser.add_option("--fixed-files", "-F", "registered files: none, register, direct", false, "none");
+    parser.add_option("--json", "-J", "write the run summary and latency percentiles to this JSON file", false);
     parser.add_option("--log", "-L", "log level", false, "INFO");
+    parser.add_option("--threads", "-T", "number of copy threads, each with its own ring", false, "1");
+    parser.add_option("--chunk", "-C", "work-stealing chunk size in bytes", false, "8388608");
+    parser.add_flag("--link", "", "submit read and write of a block as one linked SQE chain");
+    parser.add_flag("--iopoll", "", "poll for completions (IORING_SETUP_IOPOLL)");
+    parser.add_flag("--sqpoll", "", "submit from a kernel SQ poll thread (IORING_SETUP_SQPOLL)");
+    parser.add_option("--sq-idle", "", "SQ poll thread idle time before sleeping (unit: ms)", false, "20000");
+    parser.add_option("--sq-cpu", "", "pin the SQ poll thread to this CPU, -1 for no affinity", false, "-1");
+    parser.add_flag("--sq-shared", "", "share one SQ poll thread across all copy rings (IORING_SETUP_ATTACH_WQ)");
     if (!parser.parse(argc, argv))
     {
         return 1;
@@ -498,17 +2698,70 @@ int main(int argc, char *argv[])
     {
         auto source = parser.get_positional("source").value();
         auto filename = parser.get("filename").value_or("");
-        __u64 insize = std::stoi(parser.get("nlb").value_or("0"));
-        int bs = std::stoi(parser.get("bs").value_or("256"));
-        int qd = std::stoi(parser.get("depth").value_or("32"));
-
-        std::unique_ptr<IOHandler> src_handler, dest_handler; // Declare unique_ptr for both source
-        src_handler = create_handler(source, true);
-        dest_handler = create_handler(filename, false);
-        if (src_handler->get_size() && src_handler->get_size() < insize)
+        __u64 insize = std::stoull(parser.get("nlb").value_or("0"));
+        copy_options opts;
+        opts.bs = std::stoi(parser.get("bs").value_or("256"));
+        opts.qd = std::stoi(parser.get("depth").value_or("32"));
+        opts.files = parse_fixed_file_mode(parser.get("fixed-files").value_or("none"));
+        opts.link = parser.is_set("--link");
+        opts.threads = std::stoi(parser.get("threads").value_or("1"));
+        opts.chunk = std::stoull(parser.get("chunk").value_or("8388608"));
+        opts.iopoll = parser.is_set("--iopoll");
+        opts.sqpoll = parser.is_set("--sqpoll");
+        opts.sq_idle = std::stoul(parser.get("sq-idle").value_or("20000"));
+        opts.sq_cpu = std::stoi(parser.get("sq-cpu").value_or("-1"));
+        opts.sq_shared = parser.is_set("--sq-shared");
+        opts.adaptive = parser.is_set("--adaptive");
+        opts.min_qd = std::stoi(parser.get("min-depth").value_or("1"));
+        opts.json = parser.get("json").value_or("");
+        opts.run_ns = std::stod(parser.get("time").value_or("0")) * 60 * 1e9;
+        opts.interval_ns = std::stod(parser.get("interval").value_or("0")) * 1e9;
+        opts.verify = parser.is_set("--verify");
+        opts.sparse = !parser.is_set("--no-sparse");
+        opts.zero_detect = parser.is_set("--zero-detect");
+        // Without separate windows one block holds both slots, as before.
+        bool windows = parser.get("read-depth") || parser.get("write-depth");
+        opts.read_qd = std::stoi(parser.get("read-depth").value_or(std::to_string(opts.qd)));
+        opts.write_qd = std::stoi(parser.get("write-depth").value_or(std::to_string(opts.qd)));
+        opts.buffers = std::stoi(parser.get("buffers").value_or(std::to_string(windows ? opts.read_qd + opts.write_qd : opts.qd)));
+        opts.digest = parser.get("digest").value_or("");
+        opts.hash_threads = std::stoi(parser.get("hash-threads").value_or("2"));
+        opts.io_timeout_ns = std::stod(parser.get("io-timeout").value_or("0")) * 1e6;
+        opts.lr = std::stoi(parser.get("lr").value_or("0")) ? 1 : 0;
+        opts.retries = std::stoi(parser.get("retries").value_or("0"));
+        opts.retry_backoff_ns = std::stod(parser.get("retry-backoff").value_or("10")) * 1e6;
+        opts.bad_ranges = parser.get("bad-ranges").value_or("");
+        opts.workload = parse_workload(parser.get("rw").value_or(""), std::stoi(parser.get("rwmixread").value_or("50")),
+                                       parser.get("random-distribution").value_or("uniform"), parser.get("bssplit").value_or(""));
+
+        std::unique_ptr<IOHandler> src_handler;
+        src_handler = create_handler(source, opts.workload.enabled && opts.workload.read_pct < 100 ? O_RDWR : O_RDONLY);
+
+        // One source read feeds every comma-separated destination.
+        std::vector<std::unique_ptr<IOHandler>> dest_handlers;
+        std::vector<IOHandler *> dests;
+        // --verify reads every block back, so destinations must be readable too.
+        int dest_access = opts.verify ? (O_RDWR | O_CREAT | O_TRUNC) : O_WRONLY;
+        for (size_t pos = 0; !opts.workload.enabled && pos < filename.size();)
+        {
+            size_t next = filename.find(',', pos);
+            dest_handlers.push_back(create_handler(filename.substr(pos, next - pos), dest_access));
+            if (dest_handlers.back()->is_valid())
+                dests.push_back(dest_handlers.back().get());
+            pos = next == std::string::npos ? filename.size() : next + 1;
+        }
+        if (src_handler->get_size() && (insize == 0 || src_handler->get_size() < insize))
             insize = src_handler->get_size();
 
-        run_copy_logic(*src_handler, *dest_handler, insize, bs, qd);
+        // The first Ctrl-C cancels the I/O in flight and ends the run with a
+        // report; a second one kills the process.
+        struct sigaction sa = {};
+        sa.sa_handler = [](int)
+        { cancel_requested.store(true, std::memory_order_relaxed); };
+        sa.sa_flags = SA_RESETHAND;
+        sigaction(SIGINT, &sa, nullptr);
+
+        run_copy_logic(*src_handler, dests, insize, opts);
     }
     catch (const std::exception &e)
     {
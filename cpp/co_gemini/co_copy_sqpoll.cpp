@@ -1,5 +1,6 @@
 #include "util/argparser.hpp"
 #include "util/logger.hpp"
+#include "util/io_context.hpp"
 
 #include <iostream>
 #include <vector>
@@ -8,7 +9,7 @@
 #include <coroutine>
 #include <stdexcept>
 #include <memory>
-#include <functional>
+#include <algorithm>
 #include <charconv>
 #include <cstring>
 #include <liburing.h>
@@ -31,50 +32,14 @@ static inline void io_uring_prep_nvme_cmd(struct io_uring_sqe *sqe, int fd)
 }
 #endif
 
-struct task
+struct request : IoCompletion
 {
-    struct promise_type
-    {
-        task get_return_object() { return {}; }
-        std::suspend_never initial_suspend() { return {}; }
-        std::suspend_never final_suspend() noexcept { return {}; }
-        void return_void() {}
-        void unhandled_exception() { std::terminate(); }
-    };
-};
-
-struct request
-{
-    std::coroutine_handle<> handle;
-    int cqe_res;
     __u64 slba;
     char rw_dir;
     struct iovec iov;
     std::unique_ptr<char[]> buf;
 };
 
-struct io_awaitable
-{
-    request *req;
-
-    io_awaitable(request *r) : req(r) {}
-    bool await_ready() const { return false; }
-    void await_suspend(std::coroutine_handle<> h)
-    {
-        req->handle = h;
-        logger.debug("await_suspend: {} {}", req->rw_dir, req->slba);
-    }
-    int await_resume() const
-    {
-        if (req->cqe_res < 0)
-        {
-            throw std::runtime_error(strerror(-req->cqe_res));
-        }
-        logger.debug("await_resume: {} {}", req->rw_dir, req->slba);
-        return req->cqe_res;
-    }
-};
-
 class IOHandler
 {
 protected:
@@ -139,7 +104,7 @@ public:
         req->rw_dir = 'R';
         req->slba = offset;
         io_uring_prep_readv(sqe, fd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
 
     void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
@@ -149,7 +114,7 @@ public:
         req->rw_dir = 'W';
         req->slba = offset;
         io_uring_prep_writev(sqe, fd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
     const std::string &get_name() const override { return path; }
     bool is_block_device() const override { return false; }
@@ -236,7 +201,7 @@ public:
         req->rw_dir = 'R';
         req->slba = offset;
         io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
 
     void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
@@ -256,7 +221,7 @@ public:
         req->rw_dir = 'W';
         req->slba = offset;
         io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
 
     int get_file_size()
@@ -290,89 +255,99 @@ public:
     size_t get_size() const override { return dev_size; }
 };
 
-task read_and_write_block(struct io_uring *ring, IOHandler &src, IOHandler &dest, __u64 offset, __u32 block_size, std::function<void()> on_complete)
+Task<> read_and_write_block(IoContext &ctx, IOHandler &src, IOHandler &dest, request &req, __u64 offset, __u32 block_size)
 {
-    request req;
-    req.buf = std::make_unique<char[]>(block_size);
+    logger.debug("before queue_rw_pair read: offset: {}", offset);
+    src.prep_read(ctx.ring(), offset, block_size, &req);
+    int bytes_read = co_await ctx.wait(req);
+    if (bytes_read < 0)
+        throw std::runtime_error(strerror(-bytes_read));
+    logger.debug("complete queue_rw_pair read: offset: {}", offset);
 
-    try
+    if (dest.is_valid())
     {
-        logger.debug("before queue_rw_pair read: offset: {}", offset);
-        src.prep_read(ring, offset, block_size, &req);
-        int bytes_read = co_await io_awaitable(&req);
-        logger.debug("complete queue_rw_pair read: offset: {}", offset);
+        dest.prep_write(ctx.ring(), offset, bytes_read, &req);
+        int ret = co_await ctx.wait(req);
+        if (ret < 0)
+            throw std::runtime_error(strerror(-ret));
+        logger.debug("complete queue_rw_pair write: offset {}", offset);
+    }
+}
 
-        if (dest.is_valid())
+// One of qd workers; each takes the next block as soon as its previous one is written.
+Task<> copy_worker(IoContext &ctx, IOHandler &src, IOHandler &dest, __u64 &next, __u64 insize, int bs)
+{
+    request req;
+    req.buf = std::make_unique<char[]>(bs);
+    while (next < insize)
+    {
+        __u64 offset = next;
+        __u32 this_size = std::min<__u64>(insize - offset, bs);
+        next += this_size;
+        try
         {
-            dest.prep_write(ring, offset, bytes_read, &req);
-            co_await io_awaitable(&req);
-            logger.debug("complete queue_rw_pair write: offset {}", offset);
+            co_await read_and_write_block(ctx, src, dest, req, offset, this_size);
+        }
+        catch (const std::runtime_error &e)
+        {
+            logger.error("Error at offset {}: {}", offset, e.what());
         }
     }
-    catch (const std::runtime_error &e)
-    {
-        logger.error("Error at offset {}: {}", offset, e.what());
-    }
-    on_complete();
 }
 
-task run_admin_identify(struct io_uring *ring, const std::string &dev_path, std::function<void()> on_complete)
+Task<> run_admin_identify(IoContext &ctx, const std::string &dev_path)
 {
     int fd = open(dev_path.c_str(), O_RDONLY);
     if (fd < 0)
-    {
-        on_complete();
         throw std::runtime_error("Failed to open device for admin cmd: " + dev_path);
-    }
-
-    request req;
-    req.buf = std::make_unique<char[]>(4096);
-
-    try
-    {
-        io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        auto cmd = (struct nvme_uring_cmd *)sqe->cmd;
-        memset(cmd, 0, sizeof(struct nvme_uring_cmd));
-        cmd->opcode = nvme_admin_identify;
-        cmd->nsid = 0;
-        cmd->addr = (__u64)req.buf.get();
-        cmd->data_len = 4096;
-        cmd->cdw10 = NVME_IDENTIFY_CNS_CTRL;
 
-        io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, &req);
-
-        logger.debug("Submitting Identify Controller command...");
-        co_await io_awaitable(&req);
-        logger.debug("Admin command completed.");
+    auto buf = std::make_unique<char[]>(4096);
+    struct nvme_uring_cmd cmd = {};
+    cmd.opcode = nvme_admin_identify;
+    cmd.nsid = 0;
+    cmd.addr = (__u64)buf.get();
+    cmd.data_len = 4096;
+    cmd.cdw10 = NVME_IDENTIFY_CNS_CTRL;
 
-        std::string model_number(req.buf.get() + 4, 40);
-        model_number.erase(model_number.find_last_not_of(' ') + 1);
-        logger.debug(" > Model Number: {}", model_number);
-    }
-    catch (const std::runtime_error &e)
+    logger.debug("Submitting Identify Controller command...");
+    int ret = co_await ctx.uring_cmd(fd, NVME_URING_CMD_ADMIN, &cmd, sizeof(cmd));
+    close(fd);
+    if (ret != 0)
     {
-        logger.error("Admin command failed: {}", e.what());
+        logger.error("Admin command failed: {}", ret < 0 ? strerror(-ret) : "NVMe status " + std::to_string(ret));
+        co_return;
     }
-    close(fd);
-    on_complete();
+    logger.debug("Admin command completed.");
+
+    std::string model_number(buf.get() + 4, 40);
+    model_number.erase(model_number.find_last_not_of(' ') + 1);
+    logger.debug(" > Model Number: {}", model_number);
 }
 
-void run_copy_logic(IOHandler &src, IOHandler &dest, __u64 insize, int bs, int qd)
+void run_copy_logic(IOHandler &src, IOHandler &dest, __u64 insize, int bs, int qd, unsigned sq_idle, int sq_cpu)
 {
-    struct io_uring ring;
     struct io_uring_params params = {};
 
     params.flags |= IORING_SETUP_SQE128 | IORING_SETUP_CQE32 | IORING_SETUP_SQPOLL;
-    params.sq_thread_idle = 20000;
+    params.sq_thread_idle = sq_idle;
+    if (sq_cpu >= 0)
+    {
+        params.flags |= IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = sq_cpu;
+    }
 
-    logger.debug("try io_uring_queue_init_params: flags {}", params.flags);
-    if (io_uring_queue_init_params(qd, &ring, &params) < 0)
+    std::unique_ptr<IoContext> ctx;
+    try
+    {
+        logger.debug("try io_uring_queue_init_params: flags {}", params.flags);
+        ctx = std::make_unique<IoContext>(qd, params);
+    }
+    catch (const std::runtime_error &)
     {
         params = {}; // SQPOLL 실패 시 플래그 초기화
+        params.flags = IORING_SETUP_SQE128 | IORING_SETUP_CQE32;
         logger.debug("try io_uring_queue_init_params: flags {}", params.flags);
-        if (io_uring_queue_init_params(qd, &ring, &params) < 0)
-            throw std::runtime_error("io_uring_queue_init failed.");
+        ctx = std::make_unique<IoContext>(qd, params);
         logger.debug("Note: SQPOLL not supported, running in normal mode.");
     }
 
@@ -381,67 +356,12 @@ void run_copy_logic(IOHandler &src, IOHandler &dest, __u64 insize, int bs, int q
     else
         logger.info("Copying {} bytes from {}", insize, src.get_name());
 
-    int inflight = 0;
-    __u64 offset = 0;
-    bool all_submitted = false;
-
-    // 통합 이벤트 루프
-    while (inflight > 0 || !all_submitted)
-    {
-        // 1. 제출 단계: 큐에 공간이 있으면 최대한 제출
-        while (inflight < qd && !all_submitted)
-        {
-            __u64 this_size = (insize - offset < static_cast<__u64>(bs)) ? (insize - offset) : bs;
-            if (this_size == 0)
-            {
-                all_submitted = true;
-                break;
-            }
-            read_and_write_block(&ring, src, dest, offset, this_size, [&]()
-                                 { inflight--; });
-
-            logger.debug("read_and_write_block called with offset: {}, size: {}, inflight: {}", offset, this_size, inflight);
-            offset += this_size;
-            inflight++;
-        }
-
-        // 2. 제출 및 대기 결정
-        int submitted = 0;
-        // 큐가 꽉 찼거나, 모든 작업을 제출했다면 반드시 wait 해야 함
-        if (inflight >= qd || (all_submitted && inflight > 0))
-        {
-            logger.debug("try io_uring_submit_and_wait: flags {} inflight {}", params.flags, inflight);
-            submitted = io_uring_submit_and_wait(&ring, 1);
-        }
-        else
-        {
-            logger.debug("try io_uring_submit: flags {} inflight {}", params.flags, inflight);
-            submitted = io_uring_submit(&ring);
-        }
-
-        logger.debug("Submitted {} requests, inflight {}", submitted, inflight);
-        if (submitted < 0)
-        {
-            throw std::runtime_error("io_uring_submit failed: " + std::string(strerror(-submitted)));
-        }
-
-        // 3. 완료 처리 (CQE 일괄 처리)
-        unsigned cqe_head;
-        struct io_uring_cqe *cqe;
-        io_uring_for_each_cqe(&ring, cqe_head, cqe)
-        {
-            auto *req = static_cast<request *>(io_uring_cqe_get_data(cqe));
-            if (req)
-            {
-                req->cqe_res = cqe->res;
-                req->handle.resume();
-            }
-        }
-        io_uring_cq_advance(&ring, io_uring_cq_ready(&ring));
-        logger.debug("Processed CQEs, inflight: {}", inflight);
-    }
+    // qd workers keep qd blocks in flight; the context submits and reaps in batches.
+    __u64 next = 0;
+    for (int i = 0; i < qd; i++)
+        ctx->spawn(copy_worker(*ctx, src, dest, next, insize, bs));
+    ctx->run();
     logger.debug("Copy finished.");
-    io_uring_queue_exit(&ring);
 }
 
 std::unique_ptr<IOHandler> create_handler(const std::string &path, bool is_source)
@@ -498,6 +418,8 @@ int main(int argc, char *argv[])
     parser.add_option("--bs", "-c", "block size", false, "512");
     parser.add_option("--depth", "-d", "io depth", false, "64");
     parser.add_option("--time", "-t", "test time (unit: min)", false, "2");
+    parser.add_option("--sq-idle", "", "SQ poll thread idle time before sleeping (unit: ms)", false, "20000");
+    parser.add_option("--sq-cpu", "", "pin the SQ poll thread to this CPU, -1 for no affinity", false, "-1");
     parser.add_option("--log", "-L", "log level", false, "INFO");
     if (!parser.parse(argc, argv))
     {
@@ -513,6 +435,8 @@ int main(int argc, char *argv[])
         __u64 insize = std::stoi(parser.get("nlb").value_or("0"));
         int bs = std::stoi(parser.get("bs").value_or("256"));
         int qd = std::stoi(parser.get("depth").value_or("32"));
+        unsigned sq_idle = std::stoul(parser.get("sq-idle").value_or("20000"));
+        int sq_cpu = std::stoi(parser.get("sq-cpu").value_or("-1"));
 
         std::unique_ptr<IOHandler> src_handler, dest_handler; // Declare unique_ptr for both source
         src_handler = create_handler(source, true);
@@ -520,7 +444,7 @@ int main(int argc, char *argv[])
         if (src_handler->get_size() && src_handler->get_size() < insize)
             insize = src_handler->get_size();
 
-        run_copy_logic(*src_handler, *dest_handler, insize, bs, qd);
+        run_copy_logic(*src_handler, *dest_handler, insize, bs, qd, sq_idle, sq_cpu);
     }
     catch (const std::exception &e)
     {
@@ -1,5 +1,6 @@
 #include "util/argparser.hpp"
 #include "util/logger.hpp"
+#include "util/io_context.hpp"
 
 #include <iostream>
 #include <vector>
@@ -8,7 +9,7 @@
 #include <coroutine>
 #include <stdexcept>
 #include <memory>
-#include <functional>
+#include <algorithm>
 #include <charconv>
 #include <cstring>
 #include <liburing.h>
@@ -29,48 +30,12 @@ static inline void io_uring_prep_nvme_cmd(struct io_uring_sqe *sqe, int fd)
 }
 #endif
 
-struct task
+struct request : IoCompletion
 {
-    struct promise_type
-    {
-        task get_return_object() { return {}; }
-        std::suspend_never initial_suspend() { return {}; }
-        std::suspend_never final_suspend() noexcept { return {}; }
-        void return_void() {}
-        void unhandled_exception() { std::terminate(); }
-    };
-};
-
-struct request
-{
-    std::coroutine_handle<> handle;
-    int cqe_res;
     struct iovec iov;
     std::unique_ptr<char[]> buf;
 };
 
-struct io_awaitable
-{
-    request *req;
-
-    io_awaitable(request *r) : req(r) {}
-    bool await_ready() const { return false; }
-    void await_suspend(std::coroutine_handle<> h)
-    {
-        req->handle = h;
-        std::cout << "await_suspend: " << h.address() << std::endl;
-    }
-    int await_resume() const
-    {
-        if (req->cqe_res < 0)
-        {
-            throw std::runtime_error(strerror(-req->cqe_res));
-        }
-        std::cout << "await_resume: " << req->cqe_res << std::endl;
-        return req->cqe_res;
-    }
-};
-
 class IOHandler
 {
 protected:
@@ -133,7 +98,7 @@ public:
         io_uring_sqe *sqe = io_uring_get_sqe(ring);
         req->iov = {.iov_base = req->buf.get(), .iov_len = len};
         io_uring_prep_readv(sqe, fd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
 
     void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
@@ -141,7 +106,7 @@ public:
         io_uring_sqe *sqe = io_uring_get_sqe(ring);
         req->iov.iov_len = len;
         io_uring_prep_writev(sqe, fd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
     const std::string &get_name() const override { return path; }
     bool is_block_device() const override { return false; }
@@ -184,7 +149,7 @@ public:
         cmd->cdw10 = (offset / lba_size);
         cmd->cdw12 = (len / lba_size) - 1;
         io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
 
     void prep_write(io_uring *ring, __u64 offset, __u32 len, request *req) override
@@ -199,135 +164,93 @@ public:
         cmd->cdw10 = (offset / lba_size);
         cmd->cdw12 = (len / lba_size) - 1;
         io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, req);
+        io_uring_sqe_set_data(sqe, static_cast<IoCompletion *>(req));
     }
     const std::string &get_name() const override { return path; }
     bool is_block_device() const override { return true; }
     size_t get_size() const override { return dev_size; }
 };
 
-task read_and_write_block(struct io_uring *ring, IOHandler &src, IOHandler &dest, __u64 offset, __u32 block_size, std::function<void()> on_complete)
+Task<> read_and_write_block(IoContext &ctx, IOHandler &src, IOHandler &dest, request &req, __u64 offset, __u32 block_size)
 {
-    request req;
-    req.buf = std::make_unique<char[]>(block_size);
+    std::cout << "before queue_rw_pair read: offset: " << offset << std::endl;
+    src.prep_read(ctx.ring(), offset, block_size, &req);
+    int bytes_read = co_await ctx.wait(req);
+    if (bytes_read < 0)
+        throw std::runtime_error(strerror(-bytes_read));
+    std::cout << "complete queue_rw_pair read: offset: " << offset << std::endl;
 
-    try
+    if (dest.is_valid())
     {
-        std::cout << "before queue_rw_pair read: offset: " << offset << std::endl;
-        src.prep_read(ring, offset, block_size, &req);
-        int bytes_read = co_await io_awaitable(&req);
-        std::cout << "complete queue_rw_pair read: offset: " << offset << std::endl;
+        dest.prep_write(ctx.ring(), offset, bytes_read, &req);
+        int ret = co_await ctx.wait(req);
+        if (ret < 0)
+            throw std::runtime_error(strerror(-ret));
+        std::cout << "complete queue_rw_pair write: offset: " << offset << std::endl;
+    }
+}
 
-        if (dest.is_valid())
+Task<> copy_worker(IoContext &ctx, IOHandler &src, IOHandler &dest, __u64 &next, __u64 insize, int bs)
+{
+    request req;
+    req.buf = std::make_unique<char[]>(bs);
+    while (next < insize)
+    {
+        __u64 offset = next;
+        __u32 this_size = std::min<__u64>(insize - offset, bs);
+        next += this_size;
+        try
         {
-            dest.prep_write(ring, offset, bytes_read, &req);
-            co_await io_awaitable(&req);
-            std::cout << "complete queue_rw_pair write: offset: " << offset << std::endl;
+            co_await read_and_write_block(ctx, src, dest, req, offset, this_size);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Error at offset " << offset << ": " << e.what() << std::endl;
         }
     }
-    catch (const std::runtime_error &e)
-    {
-        std::cerr << "Error at offset " << offset << ": " << e.what() << std::endl;
-    }
-    on_complete();
 }
 
-task run_admin_identify(struct io_uring *ring, const std::string &dev_path, std::function<void()> on_complete)
+Task<> run_admin_identify(IoContext &ctx, const std::string &dev_path)
 {
     int fd = open(dev_path.c_str(), O_RDONLY);
     if (fd < 0)
-    {
-        on_complete();
         throw std::runtime_error("Failed to open device for admin cmd: " + dev_path);
-    }
 
-    request req;
-    req.buf = std::make_unique<char[]>(4096);
+    auto buf = std::make_unique<char[]>(4096);
+    struct nvme_uring_cmd cmd = {};
+    cmd.opcode = nvme_admin_identify;
+    cmd.addr = (__u64)buf.get();
+    cmd.data_len = 4096;
+    cmd.cdw10 = 1;
 
-    try
-    {
-        io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        auto cmd = (struct nvme_uring_cmd *)sqe->cmd;
-        memset(cmd, 0, sizeof(struct nvme_uring_cmd));
-        cmd->opcode = nvme_admin_identify;
-        cmd->addr = (__u64)req.buf.get();
-        cmd->data_len = 4096;
-        cmd->cdw10 = 1;
-
-        io_uring_prep_nvme_cmd(sqe, fd);
-        io_uring_sqe_set_data(sqe, &req);
-
-        std::cout << "Submitting Identify Controller command..." << std::endl;
-        co_await io_awaitable(&req);
-        std::cout << "Admin command completed." << std::endl;
-
-        std::string model_number(req.buf.get() + 4, 40);
-        model_number.erase(model_number.find_last_not_of(' ') + 1);
-        std::cout << " > Model Number: " << model_number << std::endl;
-    }
-    catch (const std::runtime_error &e)
+    std::cout << "Submitting Identify Controller command..." << std::endl;
+    int ret = co_await ctx.uring_cmd(fd, NVME_URING_CMD_ADMIN, &cmd, sizeof(cmd));
+    close(fd);
+    if (ret != 0)
     {
-        std::cerr << "Admin command failed: " << e.what() << std::endl;
+        std::cerr << "Admin command failed: " << (ret < 0 ? strerror(-ret) : "NVMe status " + std::to_string(ret)) << std::endl;
+        co_return;
     }
-    close(fd);
-    on_complete();
+    std::cout << "Admin command completed." << std::endl;
+
+    std::string model_number(buf.get() + 4, 40);
+    model_number.erase(model_number.find_last_not_of(' ') + 1);
+    std::cout << " > Model Number: " << model_number << std::endl;
 }
 
 void run_copy_logic(IOHandler &src, IOHandler &dest, __u64 insize, int bs, int qd)
 {
-    struct io_uring ring;
-    int ring_flags;
-    ring_flags = 0;
-    ring_flags |= IORING_SETUP_SQE128;
-    ring_flags |= IORING_SETUP_CQE32;
-
-    io_uring_queue_init(qd, &ring, 0);
+    IoContext ctx(qd, IORING_SETUP_SQE128 | IORING_SETUP_CQE32);
     std::cout << "Copying " << insize << " bytes from " << src.get_name();
     if (dest.is_valid())
         std::cout << " to " << dest.get_name() << "...";
     std::cout << std::endl;
 
-    int inflight = 0;
-    int ret = 0;
-    __u64 offset = 0;
-
-    while (offset < insize)
-    {
-        while (inflight < qd && offset < insize)
-        {
-            __u64 this_size = (insize - offset < static_cast<__u64>(bs)) ? (insize - offset) : bs;
-            read_and_write_block(&ring, src, dest, offset, this_size, [&]()
-                                 { inflight--; });
-            offset += this_size;
-            inflight++;
-        }
-
-        io_uring_submit(&ring);
-        int wait_count = (offset < insize && inflight > 0) ? 1 : inflight;
-        for (int i = 0; i < wait_count; ++i)
-        {
-            struct io_uring_cqe *cqe;
-            ret = io_uring_wait_cqe(&ring, &cqe);
-            if (ret < 0)
-            {
-                if (-ret != EAGAIN)
-                    std::cerr << "io_uring_wait_cqe: " << strerror(-ret) << std::endl;
-                inflight--;
-                continue;
-            }
-
-            auto *req = static_cast<request *>(io_uring_cqe_get_data(cqe));
-            if (req)
-            {
-                req->cqe_res = cqe->res;
-                req->handle.resume();
-            }
-            io_uring_cqe_seen(&ring, cqe);
-            std::cout << "Processed CQEs, inflight: " << inflight << std::endl;
-        }
-    }
+    __u64 next = 0;
+    for (int i = 0; i < qd; i++)
+        ctx.spawn(copy_worker(ctx, src, dest, next, insize, bs));
+    ctx.run();
     std::cout << "Copy finished." << std::endl;
-    io_uring_queue_exit(&ring);
 }
 
 std::unique_ptr<IOHandler> create_handler(const std::string &path, bool is_source)
@@ -381,7 +304,6 @@ int main(int argc, char *argv[])
     }
 
     std::string command = argv[1];
-    struct io_uring ring;
     int qd = 256;
 
     try
@@ -400,11 +322,8 @@ int main(int argc, char *argv[])
         }
         else if (command == "admin" && argc >= 4 && std::string(argv[2]) == "identify")
         {
-            io_uring_queue_init(qd, &ring, 0);
-            int inflight = 1;
-            run_admin_identify(&ring, argv[3], [&]()
-                               { inflight--; });
-            // run_copy_logic(&ring, inflight);
+            IoContext ctx(qd, IORING_SETUP_SQE128 | IORING_SETUP_CQE32);
+            ctx.run(run_admin_identify(ctx, argv[3]));
         }
         else
         {
@@ -415,8 +334,6 @@ int main(int argc, char *argv[])
     catch (const std::exception &e)
     {
         std::cerr << "Error: " << e.what() << std::endl;
-        if (ring.ring_fd)
-            io_uring_queue_exit(&ring);
         return 1;
     }
     return 0;
@@ -1,3 +1,5 @@
+#include "util/io_context.hpp"
+
 #include <iostream>
 #include <vector>
 #include <fcntl.h>
@@ -5,161 +7,56 @@
 #include <coroutine>
 #include <stdexcept>
 #include <memory>
-#include <functional>
 #include <cstring>
+#include <algorithm>
 
 // 파일 디스크립터 정의
 int infd = -1, outfd = -1;
 
-// 간단한 비동기 작업을 위한 task 타입
-struct task
-{
-    struct promise_type
-    {
-        task get_return_object() { return {}; }
-        std::suspend_never initial_suspend() { return {}; }
-        std::suspend_never final_suspend() noexcept { return {}; }
-        void return_void() {}
-        void unhandled_exception() { std::terminate(); }
-    };
-};
-
-// io_uring 작업을 위한 사용자 데이터
-struct request
-{
-    std::coroutine_handle<> handle;
-    int cqe_res;
-    __u64 slba;
-    char rw_dir;
-    struct iovec iov;
-    std::unique_ptr<char[]> buf;
-};
-
-struct io_awaitable
-{
-    request *req;
-
-    io_awaitable(request *r) : req(r) {}
-    bool await_ready() const { return false; }
-    void await_suspend(std::coroutine_handle<> h)
-    {
-        req->handle = h;
-        std::cout << "await_suspend: " << req->rw_dir << " " << req->slba << std::endl;
-    }
-    int await_resume() const
-    {
-        if (req->cqe_res < 0)
-        {
-            throw std::runtime_error(strerror(-req->cqe_res));
-        }
-        std::cout << "await_resume: " << req->rw_dir << " " << req->slba << std::endl;
-        return req->cqe_res;
-    }
-};
-
-// 읽기 작업을 위한 Awaitable
-struct read_awaitable : public io_awaitable
-{
-    read_awaitable(struct io_uring *ring, __u64 offset, __u32 len)
-        : io_awaitable(new request{
-              .buf = std::make_unique<char[]>(len)})
-    {
-        req->iov = {.iov_base = req->buf.get(), .iov_len = len};
-        req->rw_dir = 'R';
-        req->slba = offset;
-        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        io_uring_prep_readv(sqe, infd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
-    }
-    // 소멸자에서 메모리 해제
-    ~read_awaitable() { delete req; }
-};
-
-// 쓰기 작업을 위한 Awaitable
-struct write_awaitable : public io_awaitable
-{
-    write_awaitable(struct io_uring *ring, request *read_req, __u32 len, __u64 offset)
-        : io_awaitable(read_req) // 읽기 요청의 버퍼를 재사용
-    {
-        req->rw_dir = 'W';
-        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
-        io_uring_prep_writev(sqe, outfd, &req->iov, 1, offset);
-        io_uring_sqe_set_data(sqe, req);
-    }
-    // 쓰기는 버퍼 소유권이 없으므로 소멸자에서 아무것도 하지 않음
-    ~write_awaitable() {}
-};
-
 // 한 블록을 읽고 쓰는 비동기 코루틴
-task read_and_write_block(struct io_uring *ring, __u64 offset, __u32 block_size, std::function<void()> on_complete)
+Task<> read_and_write_block(IoContext &ctx, char *buf, __u64 offset, __u32 block_size)
 {
-    try
-    {
-        // 1. 읽기 작업 Awaitable 생성 및 co_await
-        std::cout << "before queue_rw_pair read: offset: " << offset << std::endl;
-        auto reader = read_awaitable(ring, offset, block_size);
-        int bytes_read = co_await reader;
-        std::cout << "complete queue_rw_pair read: offset: " << offset << std::endl;
-
-        // 2. 쓰기 작업 Awaitable 생성 및 co_await (읽은 버퍼 재사용)
-        auto writer = write_awaitable(ring, reader.req, bytes_read, offset);
-        co_await writer;
-        std::cout << "complete queue_rw_pair write: offset: " << offset << std::endl;
-    }
-    catch (const std::runtime_error &e)
-    {
-        std::cerr << "Error at offset " << offset << ": " << e.what() << std::endl;
-    }
-
-    on_complete();
-    std::cout << "complete queue_rw_pair: " << std::endl;
+    std::cout << "before queue_rw_pair read: offset: " << offset << std::endl;
+    int bytes_read = co_await ctx.read(infd, buf, block_size, offset);
+    if (bytes_read < 0)
+        throw std::runtime_error(strerror(-bytes_read));
+    std::cout << "complete queue_rw_pair read: offset: " << offset << std::endl;
+
+    // 읽은 버퍼를 그대로 재사용하여 쓰기
+    int ret = co_await ctx.write(outfd, buf, bytes_read, offset);
+    if (ret < 0)
+        throw std::runtime_error(strerror(-ret));
+    std::cout << "complete queue_rw_pair write: offset: " << offset << std::endl;
 }
 
-void run_file_copy(struct io_uring *ring, int bs, int qd, __u64 insize)
+// 큐 깊이만큼 띄운 워커가 다음 블록을 차례로 가져가 복사
+Task<> copy_worker(IoContext &ctx, __u64 &next, __u64 insize, int bs)
 {
-    __u64 offset = 0;
-    int inflight = 0;
-
-    while (offset < insize || inflight > 0)
+    auto buf = std::make_unique<char[]>(bs);
+    while (next < insize)
     {
-        while (inflight < qd && offset < insize)
+        __u64 offset = next;
+        __u32 this_size = std::min<__u64>(insize - offset, bs);
+        next += this_size;
+        try
         {
-            __u64 this_size = (insize - offset < static_cast<__u64>(bs)) ? (insize - offset) : bs;
-
-            read_and_write_block(ring, offset, this_size, [&]()
-                                 { inflight--; });
-
-            std::cout << "read_and_write_block called with offset: " << offset << ", size: " << this_size << ", inflight: " << inflight << std::endl;
-            offset += this_size;
-            inflight++;
+            co_await read_and_write_block(ctx, buf.get(), offset, this_size);
         }
-
-        io_uring_submit(ring);
-
-        struct io_uring_cqe *cqe;
-        int wait_count = (offset < insize && inflight > 0) ? 1 : inflight;
-        for (int i = 0; i < wait_count; ++i)
+        catch (const std::runtime_error &e)
         {
-            int ret = io_uring_wait_cqe(ring, &cqe);
-            if (ret < 0)
-            {
-                if (-ret != EAGAIN)
-                    std::cerr << "io_uring_wait_cqe: " << strerror(-ret) << std::endl;
-                break;
-            }
-
-            auto *req = static_cast<request *>(io_uring_cqe_get_data(cqe));
-            if (req)
-            {
-                req->cqe_res = cqe->res;
-                req->handle.resume();
-            }
-            io_uring_cqe_seen(ring, cqe);
-            std::cout << "Processed CQEs, inflight: " << inflight << std::endl;
+            std::cerr << "Error at offset " << offset << ": " << e.what() << std::endl;
         }
     }
 }
 
+void run_file_copy(IoContext &ctx, int bs, int qd, __u64 insize)
+{
+    __u64 next = 0;
+    for (int i = 0; i < qd; i++)
+        ctx.spawn(copy_worker(ctx, next, insize, bs));
+    ctx.run();
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 4)
@@ -201,20 +98,21 @@ int main(int argc, char *argv[])
     int bs = (argc >= 5) ? std::stoi(argv[4]) : 256;
     int qd = (argc >= 6) ? std::stoi(argv[5]) : 16;
 
-    struct io_uring ring;
-    if (io_uring_queue_init(qd, &ring, 0) < 0)
+    try
     {
-        std::cerr << "Failed to initialize io_uring: " << strerror(errno) << std::endl;
+        IoContext ctx(qd);
+        std::cout << "Copying " << insize << " bytes from " << argv[1] << " to " << argv[2] << std::endl;
+        run_file_copy(ctx, bs, qd, insize);
+        std::cout << "Copy finished." << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Failed to copy: " << e.what() << std::endl;
         close(infd);
         close(outfd);
         return 1;
     }
 
-    std::cout << "Copying " << insize << " bytes from " << argv[1] << " to " << argv[2] << std::endl;
-    run_file_copy(&ring, bs, qd, insize);
-    std::cout << "Copy finished." << std::endl;
-
-    io_uring_queue_exit(&ring);
     close(infd);
     close(outfd);
     return 0;
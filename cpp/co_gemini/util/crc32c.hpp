@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC-32C (Castagnoli). On x86-64 with SSE4.2 the crc32 instruction runs three
+// independent streams to hide its 3-cycle latency, and the stream CRCs are
+// merged with precomputed zero-shift tables (Mark Adler's crc32c.c scheme).
+// Elsewhere a slicing-by-8 table implementation is used.
+// crc32c(crc32c(0, a, n), b, m) equals the CRC of a followed by b.
+class Crc32c
+{
+public:
+    static uint32_t compute(uint32_t crc, const void *buf, size_t len)
+    {
+#if defined(__x86_64__)
+        static const bool hw = __builtin_cpu_supports("sse4.2");
+        if (hw)
+            return compute_hw(crc, static_cast<const uint8_t *>(buf), len);
+#endif
+        return compute_sw(crc, static_cast<const uint8_t *>(buf), len);
+    }
+
+private:
+    static constexpr uint32_t POLY = 0x82f63b78;
+    static constexpr size_t LONG = 8192;
+    static constexpr size_t SHORT = 256;
+
+    struct Tables
+    {
+        uint32_t slice[8][256];
+        uint32_t shift_long[4][256];
+        uint32_t shift_short[4][256];
+
+        Tables()
+        {
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t crc = n;
+                for (int k = 0; k < 8; k++)
+                    crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+                slice[0][n] = crc;
+            }
+            for (uint32_t n = 0; n < 256; n++)
+                for (int k = 1; k < 8; k++)
+                    slice[k][n] = (slice[k - 1][n] >> 8) ^ slice[0][slice[k - 1][n] & 0xff];
+            zeros(shift_long, LONG);
+            zeros(shift_short, SHORT);
+        }
+
+        static uint32_t gf2_times(const uint32_t *mat, uint32_t vec)
+        {
+            uint32_t sum = 0;
+            for (; vec; vec >>= 1, mat++)
+                if (vec & 1)
+                    sum ^= *mat;
+            return sum;
+        }
+
+        static void gf2_square(uint32_t *square, const uint32_t *mat)
+        {
+            for (int n = 0; n < 32; n++)
+                square[n] = gf2_times(mat, mat[n]);
+        }
+
+        // Operator that appends len zero bytes to a CRC; len must be a power of two.
+        static void zeros_op(uint32_t *even, size_t len)
+        {
+            uint32_t odd[32];
+            odd[0] = POLY;
+            for (int n = 1; n < 32; n++)
+                odd[n] = 1u << (n - 1);
+            gf2_square(even, odd);
+            gf2_square(odd, even);
+            do
+            {
+                gf2_square(even, odd);
+                len >>= 1;
+                if (len == 0)
+                    return;
+                gf2_square(odd, even);
+                len >>= 1;
+            } while (len);
+            memcpy(even, odd, sizeof(odd));
+        }
+
+        static void zeros(uint32_t table[4][256], size_t len)
+        {
+            uint32_t op[32];
+            zeros_op(op, len);
+            for (uint32_t n = 0; n < 256; n++)
+                for (int k = 0; k < 4; k++)
+                    table[k][n] = gf2_times(op, n << (8 * k));
+        }
+    };
+
+    static const Tables &tables()
+    {
+        static const Tables t;
+        return t;
+    }
+
+    static uint32_t shift(const uint32_t table[4][256], uint32_t crc)
+    {
+        return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+    }
+
+    static uint32_t compute_sw(uint32_t crc, const uint8_t *p, size_t len)
+    {
+        const auto &t = tables().slice;
+        crc = ~crc;
+        for (; len && (reinterpret_cast<uintptr_t>(p) & 7); len--)
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        for (; len >= 8; len -= 8, p += 8)
+        {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            word ^= crc;
+            crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+                  t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        }
+        for (; len; len--)
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        return ~crc;
+    }
+
+#if defined(__x86_64__)
+    static uint64_t load64(const uint8_t *p)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        return word;
+    }
+
+    template <size_t STRIDE>
+    __attribute__((target("sse4.2"))) static uint64_t three_way(uint64_t crc0, const uint8_t *&p, size_t &len, const uint32_t table[4][256])
+    {
+        while (len >= 3 * STRIDE)
+        {
+            uint64_t crc1 = 0, crc2 = 0;
+            const uint8_t *end = p + STRIDE;
+            do
+            {
+                crc0 = _mm_crc32_u64(crc0, load64(p));
+                crc1 = _mm_crc32_u64(crc1, load64(p + STRIDE));
+                crc2 = _mm_crc32_u64(crc2, load64(p + 2 * STRIDE));
+                p += 8;
+            } while (p < end);
+            crc0 = shift(table, crc0) ^ crc1;
+            crc0 = shift(table, crc0) ^ crc2;
+            p += 2 * STRIDE;
+            len -= 3 * STRIDE;
+        }
+        return crc0;
+    }
+
+    __attribute__((target("sse4.2"))) static uint32_t compute_hw(uint32_t crc, const uint8_t *p, size_t len)
+    {
+        uint64_t crc0 = ~crc;
+        for (; len && (reinterpret_cast<uintptr_t>(p) & 7); len--)
+            crc0 = _mm_crc32_u8(crc0, *p++);
+        crc0 = three_way<LONG>(crc0, p, len, tables().shift_long);
+        crc0 = three_way<SHORT>(crc0, p, len, tables().shift_short);
+        for (; len >= 8; len -= 8, p += 8)
+            crc0 = _mm_crc32_u64(crc0, load64(p));
+        for (; len; len--)
+            crc0 = _mm_crc32_u8(crc0, *p++);
+        return ~static_cast<uint32_t>(crc0);
+    }
+#endif
+};
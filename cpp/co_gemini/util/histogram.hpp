@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+#include <ostream>
+
+// Log-linear (HDR-style) histogram for latencies in ns. Values below
+// SUB_COUNT are counted exactly; above that every power of two is split into
+// SUB_COUNT linear buckets, which bounds the relative error to 1/SUB_COUNT.
+// record() is a shift, a clz and an increment, cheap enough for every CQE.
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(uint64_t value)
+    {
+        counts_[index(value)]++;
+        total_++;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t min() const { return total_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? static_cast<double>(sum_) / total_ : 0; }
+
+    // Highest value equivalent to the bucket holding the p-th percentile.
+    uint64_t percentile(double p) const
+    {
+        if (total_ == 0)
+            return 0;
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(p / 100.0 * total_ + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts_[i];
+            if (seen >= target)
+                return std::min(highest_equivalent(i), max_);
+        }
+        return max_;
+    }
+
+    void to_json(std::ostream &os) const
+    {
+        os << "{\"count\": " << total_ << ", \"min\": " << min() << ", \"mean\": " << static_cast<uint64_t>(mean())
+           << ", \"p50\": " << percentile(50) << ", \"p90\": " << percentile(90) << ", \"p99\": " << percentile(99)
+           << ", \"p99.9\": " << percentile(99.9) << ", \"max\": " << max_ << "}";
+    }
+
+private:
+    std::array<uint64_t, BUCKETS> counts_{};
+    uint64_t total_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+
+    static int index(uint64_t value)
+    {
+        if (value < SUB_COUNT)
+            return value;
+        int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + ((value >> shift) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t highest_equivalent(int idx)
+    {
+        if (idx < SUB_COUNT)
+            return idx;
+        int shift = idx / SUB_COUNT - 1;
+        uint64_t lowest = static_cast<uint64_t>(SUB_COUNT + idx % SUB_COUNT) << shift;
+        return lowest + (1ull << shift) - 1;
+    }
+};
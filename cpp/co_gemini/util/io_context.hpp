@@ -0,0 +1,424 @@
+#pragma once
+
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <time.h>
+#include <liburing.h>
+
+// Completion record of one SQE; its address is the SQE's user_data. The CQE is
+// copied into it before the waiting coroutine resumes. A record with a parent
+// is one child of a group, which completes when the last of its children does.
+struct IoCompletion
+{
+    std::coroutine_handle<> handle;
+    int res = 0;
+    __u32 flags = 0;
+    __u64 big_cqe[2] = {}; /* extra words of a 32-byte CQE (IORING_SETUP_CQE32) */
+    IoCompletion *parent = nullptr; /* group completed by this child */
+    int pending = 0;                /* children of a group still in flight */
+};
+
+template <class T = void>
+class Task;
+
+// Promise parts shared by Task<T> and Task<void>. A task starts suspended and
+// on completion transfers control straight to its awaiter (symmetric transfer),
+// so chains of nested tasks neither grow the stack nor bounce through a loop.
+struct TaskPromiseBase
+{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    struct final_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            auto next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <class T>
+struct TaskPromise : TaskPromiseBase
+{
+    std::optional<T> value;
+
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase
+{
+    void return_void() {}
+    void result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+// Lazy coroutine task: nothing runs until it is awaited or handed to
+// IoContext::run()/spawn(). The frame is owned by the Task object.
+template <class T>
+class Task
+{
+public:
+    struct promise_type : TaskPromise<T>
+    {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+    Task(Task &&other) noexcept : h(std::exchange(other.h, {})) {}
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (h)
+                h.destroy();
+            h = std::exchange(other.h, {});
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (h)
+            h.destroy();
+    }
+
+    bool await_ready() const noexcept { return !h || h.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        h.promise().continuation = caller;
+        return h;
+    }
+    T await_resume() { return h.promise().result(); }
+
+    void start() { h.resume(); }
+    bool done() const { return h.done(); }
+    T result() { return h.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> h;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : h(handle) {}
+};
+
+// Owns an io_uring and dispatches its completions to the coroutines waiting on
+// them. Single-threaded: every task of a context runs on the thread calling run().
+class IoContext
+{
+public:
+    static constexpr unsigned CQE_BATCH = 64;
+
+    explicit IoContext(unsigned entries, unsigned flags = 0)
+    {
+        struct io_uring_params params = {};
+        params.flags = flags;
+        init(entries, params);
+    }
+
+    IoContext(unsigned entries, struct io_uring_params &params) { init(entries, params); }
+
+    IoContext(const IoContext &) = delete;
+    IoContext &operator=(const IoContext &) = delete;
+    ~IoContext() { io_uring_queue_exit(&ring_); }
+
+    struct io_uring *ring() { return &ring_; }
+
+    // Next free SQE, flushing the SQ to the kernel first when it is full.
+    struct io_uring_sqe *get_sqe()
+    {
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+        if (!sqe)
+        {
+            io_uring_submit(&ring_);
+            sqe = io_uring_get_sqe(&ring_);
+            if (!sqe)
+                throw std::runtime_error("IoContext: submission queue full");
+        }
+        return sqe;
+    }
+
+    // Awaitable that fills one SQE with prep() when the caller suspends and
+    // resumes it with cqe->res.
+    template <class Prep>
+    class op
+    {
+        IoContext &ctx;
+        Prep prep;
+        IoCompletion c;
+
+    public:
+        op(IoContext &ctx, Prep prep) : ctx(ctx), prep(std::move(prep)) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            io_uring_sqe *sqe = ctx.get_sqe();
+            prep(sqe);
+            io_uring_sqe_set_data(sqe, &c);
+            c.handle = h;
+            ctx.pending_++;
+        }
+        int await_resume() const noexcept { return c.res; }
+        const IoCompletion &completion() const { return c; }
+    };
+
+    template <class Prep>
+    op<Prep> submit(Prep prep) { return op<Prep>(*this, std::move(prep)); }
+
+    auto read(int fd, void *buf, unsigned len, __u64 offset)
+    {
+        return submit([=](io_uring_sqe *sqe)
+                      { io_uring_prep_read(sqe, fd, buf, len, offset); });
+    }
+
+    auto write(int fd, const void *buf, unsigned len, __u64 offset)
+    {
+        return submit([=](io_uring_sqe *sqe)
+                      { io_uring_prep_write(sqe, fd, buf, len, offset); });
+    }
+
+    // Passthrough command; cmd is copied into the SQE, which must be an
+    // IORING_SETUP_SQE128 one for commands over 16 bytes (e.g. nvme_uring_cmd).
+    auto uring_cmd(int fd, __u32 cmd_op, const void *cmd, size_t cmd_len)
+    {
+        auto prep = [=](io_uring_sqe *sqe)
+        {
+            io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, nullptr, 0, 0);
+            sqe->cmd_op = cmd_op;
+            memcpy(sqe->cmd, cmd, cmd_len);
+        };
+        return submit(prep);
+    }
+
+    // Resumes after ns nanoseconds with -ETIME.
+    auto timeout(__u64 ns)
+    {
+        struct __kernel_timespec ts = {.tv_sec = static_cast<long long>(ns / 1000000000), .tv_nsec = static_cast<long long>(ns % 1000000000)};
+        return submit([ts](io_uring_sqe *sqe) mutable
+                      { io_uring_prep_timeout(sqe, &ts, 0, 0); });
+    }
+
+    // For an SQE the caller prepared itself with &c as its user_data.
+    struct wait_awaitable
+    {
+        IoContext &ctx;
+        IoCompletion &c;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            c.handle = h;
+            ctx.pending_++;
+        }
+        int await_resume() const noexcept { return c.res; }
+    };
+
+    wait_awaitable wait(IoCompletion &c) { return {*this, c}; }
+
+    // Resumes once the last child of group has completed, at once if none is
+    // in flight. Children are added by pointing their parent at the group and
+    // counting them in its pending.
+    struct group_awaitable
+    {
+        IoContext &ctx;
+        IoCompletion &group;
+        bool await_ready() const noexcept { return group.pending == 0; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            group.handle = h;
+            ctx.pending_++;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    group_awaitable wait_group(IoCompletion &group) { return {*this, group}; }
+
+    // Called for every completion, and for every group its last child
+    // completes, before the coroutine waiting on it resumes. now_ns is the
+    // CLOCK_MONOTONIC time of the batch the completion was reaped in, read
+    // once per batch.
+    void on_complete(std::function<void(IoCompletion *, __u64 now_ns)> hook) { hook_ = std::move(hook); }
+
+    // Starts a task now and lets it run to completion on its own.
+    void spawn(Task<> t)
+    {
+        live_++;
+        detach(std::move(t));
+    }
+
+    // Runs t to completion and returns its result.
+    template <class T>
+    T run(Task<T> t)
+    {
+        t.start();
+        while (!t.done())
+            run_once();
+        return t.result();
+    }
+
+    // Runs until every spawned task has finished, then rethrows the first
+    // exception one of them let escape.
+    void run()
+    {
+        run([] {}, 0);
+    }
+
+    // Like run(), calling poll() after every batch of completions. Where the
+    // kernel takes a wait timeout, no wait lasts longer than poll_ns, so poll()
+    // keeps running while all I/O in flight hangs.
+    template <class Poll>
+    void run(Poll &&poll, __u64 poll_ns)
+    {
+        while (live_ > 0)
+        {
+            run_once(poll_ns);
+            poll();
+        }
+        if (error_)
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+    // Dispatches completions until no operation is in flight, such as the
+    // operands a when_any leaves running.
+    void drain()
+    {
+        while (pending_ > 0)
+            run_once();
+    }
+
+    // Submits, waits for at least one completion (or up to timeout_ns, if set
+    // and supported) and dispatches all ready ones.
+    unsigned run_once(__u64 timeout_ns = 0)
+    {
+        if (pending_ == 0)
+            throw std::runtime_error("IoContext: tasks are waiting but no I/O is in flight");
+        int ret;
+        if (timeout_ns && (ring_.features & IORING_FEAT_EXT_ARG))
+        {
+            struct __kernel_timespec ts = {.tv_sec = static_cast<long long>(timeout_ns / 1000000000), .tv_nsec = static_cast<long long>(timeout_ns % 1000000000)};
+            struct io_uring_cqe *cqe;
+            ret = io_uring_submit_and_wait_timeout(&ring_, &cqe, 1, &ts, nullptr);
+        }
+        else
+            ret = io_uring_submit_and_wait(&ring_, 1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY && ret != -ETIME)
+            throw std::runtime_error("io_uring_submit_and_wait failed: " + std::string(strerror(-ret)));
+        __u64 now = hook_ ? clock_ns() : 0;
+        auto resume = [this, now](IoCompletion *c)
+        {
+            for (;;)
+            {
+                if (hook_)
+                    hook_(c, now);
+                if (!c->parent)
+                    break;
+                c = c->parent;
+                if (--c->pending)
+                    return;
+            }
+            if (!c->handle)
+                return;
+            pending_--;
+            std::exchange(c->handle, {}).resume();
+        };
+        return reap(&ring_, resume);
+    }
+
+    // Dispatches every ready CQE of ring to complete(), CQE_BATCH at a time with
+    // one CQ head update per batch. CQEs without user_data are skipped.
+    template <class F>
+    static unsigned reap(struct io_uring *ring, F &&complete)
+    {
+        struct io_uring_cqe *cqes[CQE_BATCH];
+        bool big = ring->flags & IORING_SETUP_CQE32;
+        unsigned total = 0, n;
+        do
+        {
+            n = io_uring_peek_batch_cqe(ring, cqes, CQE_BATCH);
+            for (unsigned i = 0; i < n; i++)
+            {
+                auto *c = static_cast<IoCompletion *>(io_uring_cqe_get_data(cqes[i]));
+                if (!c)
+                    continue;
+                c->res = cqes[i]->res;
+                c->flags = cqes[i]->flags;
+                if (big)
+                {
+                    c->big_cqe[0] = cqes[i]->big_cqe[0];
+                    c->big_cqe[1] = cqes[i]->big_cqe[1];
+                }
+                complete(c);
+            }
+            io_uring_cq_advance(ring, n);
+            total += n;
+        } while (n == CQE_BATCH);
+        return total;
+    }
+
+private:
+    struct io_uring ring_;
+    int pending_ = 0;
+    int live_ = 0;
+    std::exception_ptr error_;
+    std::function<void(IoCompletion *, __u64)> hook_;
+
+    static __u64 clock_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    struct detached
+    {
+        struct promise_type
+        {
+            detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    detached detach(Task<> t)
+    {
+        try
+        {
+            co_await t;
+        }
+        catch (...)
+        {
+            if (!error_)
+                error_ = std::current_exception();
+        }
+        live_--;
+    }
+
+    void init(unsigned entries, struct io_uring_params &params)
+    {
+        int ret = io_uring_queue_init_params(entries, &ring_, &params);
+        if (ret < 0)
+            throw std::runtime_error("io_uring_queue_init_params failed: " + std::string(strerror(-ret)));
+    }
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <format>
+#include <string>
+
+// NVMe completion status as io_uring passthrough returns it in cqe->res: the
+// CQE status field without its phase tag, so SC in bits 7:0, SCT in 10:8, CRD
+// in 12:11, More in 13 and Do Not Retry in 14. The command-specific result
+// (CQE dwords 0-1) comes in big_cqe[0] of a 32-byte CQE.
+struct NvmeStatus
+{
+    uint16_t value;
+
+    explicit NvmeStatus(int res) : value(res & 0x7fff) {}
+
+    uint8_t sc() const { return value & 0xff; }
+    uint8_t sct() const { return (value >> 8) & 0x7; }
+    uint8_t crd() const { return (value >> 11) & 0x3; }
+    bool more() const { return value & 0x2000; }
+    bool dnr() const { return value & 0x4000; }
+
+    const char *name() const
+    {
+        switch (sct())
+        {
+        case 0:
+            return generic_name(sc());
+        case 1:
+            switch (sc())
+            {
+            case 0x80: return "Conflicting Attributes";
+            case 0x81: return "Invalid Protection Information";
+            case 0x82: return "Attempted Write to Read Only Range";
+            }
+            return "Command Specific Status";
+        case 2:
+            switch (sc())
+            {
+            case 0x80: return "Write Fault";
+            case 0x81: return "Unrecovered Read Error";
+            case 0x82: return "End-to-end Guard Check Error";
+            case 0x83: return "End-to-end Application Tag Check Error";
+            case 0x84: return "End-to-end Reference Tag Check Error";
+            case 0x85: return "Compare Failure";
+            case 0x86: return "Access Denied";
+            case 0x87: return "Deallocated or Unwritten Logical Block";
+            }
+            return "Media and Data Integrity Error";
+        case 3:
+            switch (sc())
+            {
+            case 0x00: return "Internal Path Error";
+            case 0x01: return "Asymmetric Access Persistent Loss";
+            case 0x02: return "Asymmetric Access Inaccessible";
+            case 0x03: return "Asymmetric Access Transition";
+            case 0x60: return "Controller Pathing Error";
+            case 0x70: return "Host Pathing Error";
+            case 0x71: return "Command Aborted By Host";
+            }
+            return "Path Related Status";
+        case 7:
+            return "Vendor Specific";
+        }
+        return "Reserved Status Code Type";
+    }
+
+    // e.g. "Unrecovered Read Error (SCT 0x2 SC 0x81, DNR)".
+    std::string str() const
+    {
+        return std::format("{} (SCT {:#x} SC {:#x}{}{})", name(), sct(), sc(), more() ? ", More" : "", dnr() ? ", DNR" : "");
+    }
+
+private:
+    static const char *generic_name(uint8_t sc)
+    {
+        switch (sc)
+        {
+        case 0x00: return "Successful Completion";
+        case 0x01: return "Invalid Command Opcode";
+        case 0x02: return "Invalid Field in Command";
+        case 0x03: return "Command ID Conflict";
+        case 0x04: return "Data Transfer Error";
+        case 0x05: return "Commands Aborted due to Power Loss Notification";
+        case 0x06: return "Internal Error";
+        case 0x07: return "Command Abort Requested";
+        case 0x08: return "Command Aborted due to SQ Deletion";
+        case 0x0b: return "Invalid Namespace or Format";
+        case 0x0c: return "Command Sequence Error";
+        case 0x0f: return "Data SGL Length Invalid";
+        case 0x13: return "PRP Offset Invalid";
+        case 0x14: return "Atomic Write Unit Exceeded";
+        case 0x15: return "Operation Denied";
+        case 0x1d: return "Sanitize In Progress";
+        case 0x20: return "Namespace is Write Protected";
+        case 0x21: return "Command Interrupted";
+        case 0x22: return "Transient Transport Error";
+        case 0x80: return "LBA Out of Range";
+        case 0x81: return "Capacity Exceeded";
+        case 0x82: return "Namespace Not Ready";
+        case 0x83: return "Reservation Conflict";
+        case 0x84: return "Format In Progress";
+        }
+        return "Generic Command Status";
+    }
+};
+
+// Completion counts per status, shared by every ring. Each SCT/SC code has a
+// counter with and one without Do Not Retry, bumped with a relaxed atomic add,
+// so recording from any thread never takes a lock.
+class NvmeStatusTable
+{
+public:
+    static constexpr int CODES = 1 << 11;
+
+    void record(NvmeStatus s)
+    {
+        counts_[index(s)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t total() const
+    {
+        uint64_t sum = 0;
+        for (auto &c : counts_)
+            sum += c.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    // Calls f(status, count) for every status seen, DNR after the retriable ones.
+    template <class F>
+    void for_each(F &&f) const
+    {
+        for (int i = 0; i < 2 * CODES; i++)
+        {
+            uint64_t n = counts_[i].load(std::memory_order_relaxed);
+            if (n)
+                f(NvmeStatus((i & (CODES - 1)) | (i >= CODES ? 0x4000 : 0)), n);
+        }
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, 2 * CODES> counts_{};
+
+    static int index(NvmeStatus s) { return (s.value & (CODES - 1)) | (s.dnr() ? CODES : 0); }
+};
@@ -0,0 +1,374 @@
+#pragma once
+
+#include "io_context.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Combinators over awaitables (Task<T>, IoContext ops, or any type with
+// await_ready/await_suspend/await_resume). Each operand is awaited by a small
+// child coroutine; the awaiting coroutine is resumed once, by whichever child
+// decides the outcome, through symmetric transfer.
+
+template <class A>
+using AwaitResult = decltype(std::declval<A &>().await_resume());
+
+// void results are stored as std::monostate.
+template <class A>
+using AwaitValue = std::conditional_t<std::is_void_v<AwaitResult<A>>, std::monostate, std::remove_cvref_t<AwaitResult<A>>>;
+
+// Child coroutine of a combinator. It starts at once and on completion tells
+// its state, which returns the coroutine to run next, then frees its own frame.
+template <class State>
+struct WhenChild
+{
+    struct promise_type
+    {
+        State *state;
+
+        template <class... Args>
+        promise_type(State *s, Args &&...) : state(s) {}
+
+        struct final_awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                auto next = h.promise().state->child_done();
+                h.destroy();
+                return next;
+            }
+            void await_resume() const noexcept {}
+        };
+
+        WhenChild get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template <class State, class A>
+WhenChild<State> when_child(State *state, A &op, std::optional<AwaitValue<A>> &out)
+{
+    try
+    {
+        if constexpr (std::is_void_v<AwaitResult<A>>)
+        {
+            co_await op;
+            out.emplace();
+        }
+        else
+            out.emplace(co_await op);
+    }
+    catch (...)
+    {
+        state->fail(std::current_exception());
+    }
+}
+
+// Shared by the all-of combinators: the awaiting coroutine resumes when the
+// last child is done. One extra count is held while the children are being
+// started, so a child that completes inline cannot resume the parent early.
+struct WhenAllCounter
+{
+    std::coroutine_handle<> parent;
+    size_t remaining = 0;
+    std::exception_ptr error;
+
+    std::coroutine_handle<> child_done()
+    {
+        if (--remaining == 0)
+            return parent;
+        return std::noop_coroutine();
+    }
+    void fail(std::exception_ptr e)
+    {
+        if (!error)
+            error = e;
+    }
+};
+
+// co_await when_all(a, b, ...) runs the operands concurrently and yields a
+// tuple of their results once every one has completed. The first exception is
+// rethrown, but only after all operands are done, so none outlives the await.
+template <class... As>
+class WhenAll : WhenAllCounter
+{
+    std::tuple<As...> ops;
+    std::tuple<std::optional<AwaitValue<As>>...> results;
+
+    template <size_t... I>
+    void start(std::index_sequence<I...>)
+    {
+        (when_child(static_cast<WhenAllCounter *>(this), std::get<I>(ops), std::get<I>(results)), ...);
+    }
+
+    template <size_t... I>
+    std::tuple<AwaitValue<As>...> collect(std::index_sequence<I...>)
+    {
+        return {std::move(*std::get<I>(results))...};
+    }
+
+public:
+    explicit WhenAll(As &&...as) : ops(std::forward<As>(as)...) {}
+
+    bool await_ready() const noexcept { return sizeof...(As) == 0; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        parent = h;
+        remaining = sizeof...(As) + 1;
+        start(std::index_sequence_for<As...>{});
+        return --remaining != 0;
+    }
+    std::tuple<AwaitValue<As>...> await_resume()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return collect(std::index_sequence_for<As...>{});
+    }
+};
+
+template <class... As>
+WhenAll<std::remove_cvref_t<As>...> when_all(As &&...as)
+{
+    return WhenAll<std::remove_cvref_t<As>...>(std::forward<As>(as)...);
+}
+
+// Range form for a run-time number of operands of one type; yields a vector of
+// results, or nothing when the operands yield void.
+template <class A>
+class WhenAllRange : WhenAllCounter
+{
+    std::vector<A> ops;
+    std::vector<std::optional<AwaitValue<A>>> results;
+
+public:
+    explicit WhenAllRange(std::vector<A> ops) : ops(std::move(ops)), results(this->ops.size()) {}
+
+    bool await_ready() const noexcept { return ops.empty(); }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        parent = h;
+        remaining = ops.size() + 1;
+        for (size_t i = 0; i < ops.size(); i++)
+            when_child(static_cast<WhenAllCounter *>(this), ops[i], results[i]);
+        return --remaining != 0;
+    }
+    auto await_resume()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<AwaitResult<A>>)
+        {
+            std::vector<AwaitValue<A>> values;
+            values.reserve(results.size());
+            for (auto &r : results)
+                values.push_back(std::move(*r));
+            return values;
+        }
+    }
+};
+
+template <class A>
+WhenAllRange<A> when_all(std::vector<A> ops)
+{
+    return WhenAllRange<A>(std::move(ops));
+}
+
+// co_await when_any(a, b, ...) resumes as soon as the first operand completes
+// and yields its result as a variant whose index() names the winner. The other
+// operands keep running to completion in the background; their state is kept
+// alive on the heap until then and their results are dropped. Operands must
+// therefore own whatever their I/O writes into (Tasks and IoContext ops do),
+// and a caller that cannot wait for them should cancel them.
+template <class... As>
+class WhenAny
+{
+    using Result = std::variant<AwaitValue<As>...>;
+
+    struct State
+    {
+        std::tuple<As...> ops;
+        std::optional<Result> result;
+        std::exception_ptr error;
+        std::coroutine_handle<> parent;
+        bool starting = false;
+        bool decided = false;
+
+        State(As &&...as) : ops(std::forward<As>(as)...) {}
+
+        std::coroutine_handle<> child_done()
+        {
+            if (!decided || starting || !parent)
+                return std::noop_coroutine();
+            return std::exchange(parent, {});
+        }
+    };
+
+    std::shared_ptr<State> state;
+
+    template <size_t I>
+    static WhenChild<State> run(State *s, std::shared_ptr<State> keep)
+    {
+        try
+        {
+            auto &op = std::get<I>(s->ops);
+            if constexpr (std::is_void_v<AwaitResult<std::tuple_element_t<I, std::tuple<As...>>>>)
+            {
+                co_await op;
+                if (!s->decided)
+                    s->result.emplace(std::in_place_index<I>);
+            }
+            else
+            {
+                auto value = co_await op;
+                if (!s->decided)
+                    s->result.emplace(std::in_place_index<I>, std::move(value));
+            }
+        }
+        catch (...)
+        {
+            if (!s->decided)
+                s->error = std::current_exception();
+        }
+        s->decided = true;
+    }
+
+    template <size_t... I>
+    void start(std::index_sequence<I...>)
+    {
+        ((state->decided ? void() : void(run<I>(state.get(), state))), ...);
+    }
+
+public:
+    explicit WhenAny(As &&...as) : state(std::make_shared<State>(std::forward<As>(as)...)) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        state->parent = h;
+        state->starting = true;
+        start(std::index_sequence_for<As...>{});
+        state->starting = false;
+        if (!state->decided)
+            return true;
+        state->parent = {};
+        return false;
+    }
+    Result await_resume()
+    {
+        if (state->error)
+            std::rethrow_exception(state->error);
+        return std::move(*state->result);
+    }
+};
+
+template <class... As>
+WhenAny<std::remove_cvref_t<As>...> when_any(As &&...as)
+{
+    static_assert(sizeof...(As) > 0, "when_any needs at least one operand");
+    return WhenAny<std::remove_cvref_t<As>...>(std::forward<As>(as)...);
+}
+
+// Scope for child tasks, replacing hand-counted inflight callbacks. start()
+// runs a task at once; wait_below(n) resumes the owner once fewer than n
+// children are running, which bounds how many are in flight, and join()
+// resumes it when the last child has finished and rethrows the first exception
+// a child let escape.
+class Nursery
+{
+    struct child
+    {
+        struct promise_type
+        {
+            Nursery *nursery;
+
+            promise_type(Nursery &n, Task<> &) : nursery(&n) {}
+
+            struct final_awaiter
+            {
+                bool await_ready() const noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    Nursery &n = *h.promise().nursery;
+                    h.destroy();
+                    if (--n.live < n.wake_below && n.parent)
+                        return std::exchange(n.parent, {});
+                    return std::noop_coroutine();
+                }
+                void await_resume() const noexcept {}
+            };
+
+            child get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            final_awaiter final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    size_t live = 0;
+    size_t wake_below = 1; /* the owner resumes once live drops under this */
+    std::coroutine_handle<> parent;
+    std::exception_ptr error;
+
+    static child run(Nursery &n, Task<> t)
+    {
+        try
+        {
+            co_await t;
+        }
+        catch (...)
+        {
+            if (!n.error)
+                n.error = std::current_exception();
+        }
+    }
+
+public:
+    Nursery() = default;
+    Nursery(const Nursery &) = delete;
+    Nursery &operator=(const Nursery &) = delete;
+
+    void start(Task<> t)
+    {
+        live++;
+        run(*this, std::move(t));
+    }
+
+    size_t size() const { return live; }
+
+    struct wait_awaitable
+    {
+        Nursery &n;
+        size_t below;
+        bool await_ready() const noexcept { return n.live < below; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            n.parent = h;
+            n.wake_below = below;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct join_awaitable : wait_awaitable
+    {
+        void await_resume()
+        {
+            if (n.error)
+                std::rethrow_exception(std::exchange(n.error, nullptr));
+        }
+    };
+
+    wait_awaitable wait_below(size_t n) { return {*this, n}; }
+    join_awaitable join() { return {{*this, 1}}; }
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Whether a buffer holds only zero bytes. Uses AVX-512 or AVX2 when the CPU
+// has them, ORing several vectors per test so a zero block is scanned at
+// memory speed, while a data block usually fails on its first word.
+class ZeroDetect
+{
+public:
+    static bool all_zero(const void *buf, size_t len)
+    {
+        const auto *p = static_cast<const uint8_t *>(buf);
+        if (len >= 8 && load64(p) != 0)
+            return false;
+#if defined(__x86_64__)
+        static const int level = __builtin_cpu_supports("avx512f") ? 2 : __builtin_cpu_supports("avx2") ? 1 : 0;
+        if (level == 2)
+            return all_zero_avx512(p, len);
+        if (level == 1)
+            return all_zero_avx2(p, len);
+#endif
+        return all_zero_sw(p, len);
+    }
+
+private:
+    static uint64_t load64(const uint8_t *p)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        return word;
+    }
+
+    static bool all_zero_sw(const uint8_t *p, size_t len)
+    {
+        uint64_t acc = 0;
+        for (; len >= 32; p += 32, len -= 32)
+        {
+            acc |= load64(p) | load64(p + 8) | load64(p + 16) | load64(p + 24);
+            if (acc)
+                return false;
+        }
+        for (; len; len--)
+            acc |= *p++;
+        return acc == 0;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("avx2"))) static bool all_zero_avx2(const uint8_t *p, size_t len)
+    {
+        for (; len >= 128; p += 128, len -= 128)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 64));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 96));
+            __m256i v = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+            if (!_mm256_testz_si256(v, v))
+                return false;
+        }
+        return all_zero_sw(p, len);
+    }
+
+    __attribute__((target("avx512f"))) static bool all_zero_avx512(const uint8_t *p, size_t len)
+    {
+        for (; len >= 256; p += 256, len -= 256)
+        {
+            __m512i a = _mm512_loadu_si512(p);
+            __m512i b = _mm512_loadu_si512(p + 64);
+            __m512i c = _mm512_loadu_si512(p + 128);
+            __m512i d = _mm512_loadu_si512(p + 192);
+            __m512i v = _mm512_or_si512(_mm512_or_si512(a, b), _mm512_or_si512(c, d));
+            if (_mm512_test_epi64_mask(v, v))
+                return false;
+        }
+        return all_zero_sw(p, len);
+    }
+#endif
+};
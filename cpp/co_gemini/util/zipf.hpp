@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+// Zipf distribution over ranks [1, n] with P(k) proportional to k^-exponent,
+// sampled by rejection-inversion (Hormann & Derflinger, 1996). Setup and each
+// sample are O(1), so n can be the block count of a whole device.
+class ZipfDistribution
+{
+public:
+    ZipfDistribution(uint64_t n, double exponent) : n_(n), s_(exponent)
+    {
+        h_integral_x1_ = h_integral(1.5) - 1.0;
+        h_integral_n_ = h_integral(n_ + 0.5);
+        threshold_ = 2.0 - h_integral_inverse(h_integral(2.5) - h(2.0));
+    }
+
+    template <class URNG>
+    uint64_t operator()(URNG &g)
+    {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (;;)
+        {
+            double u = h_integral_n_ + uniform(g) * (h_integral_x1_ - h_integral_n_);
+            double x = h_integral_inverse(u);
+            double k = std::floor(x + 0.5);
+            if (k < 1)
+                k = 1;
+            else if (k > n_)
+                k = n_;
+            if (k - x <= threshold_ || u >= h_integral(k + 0.5) - h(k))
+                return static_cast<uint64_t>(k);
+        }
+    }
+
+private:
+    uint64_t n_;
+    double s_;
+    double h_integral_x1_;
+    double h_integral_n_;
+    double threshold_;
+
+    double h(double x) const { return std::exp(-s_ * std::log(x)); }
+
+    double h_integral(double x) const
+    {
+        double log_x = std::log(x);
+        return helper2((1.0 - s_) * log_x) * log_x;
+    }
+
+    double h_integral_inverse(double x) const
+    {
+        double t = x * (1.0 - s_);
+        if (t < -1.0)
+            t = -1.0;
+        return std::exp(helper1(t) * x);
+    }
+
+    // log1p(x) / x and expm1(x) / x, kept accurate near 0 where exponent ~ 1.
+    static double helper1(double x)
+    {
+        if (std::fabs(x) > 1e-8)
+            return std::log1p(x) / x;
+        return 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+    }
+
+    static double helper2(double x)
+    {
+        if (std::fabs(x) > 1e-8)
+            return std::expm1(x) / x;
+        return 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+    }
+};